@@ -0,0 +1,68 @@
+#pragma once
+
+#include <ThreeHeap.h>
+
+// ======================================================================
+
+// Bump allocator over large blocks taken from a ThreeHeap.  Allocations are never freed individually,
+// they go away all at once on rewind() or release().  The blocks are allocated with the arena flags
+// and owned by the arena, so they show up in the heap's statistics and report_allocations().
+class ThreeArena
+{
+public:
+
+	static constexpr int64_t DefaultBlockSize = 64 * 1024;
+	static constexpr int DefaultAlignment = 16;
+
+	// Position to rewind() back to, everything allocated after it is released
+	struct Marker
+	{
+		void * block = nullptr;
+		void * oversized = nullptr;
+		intptr_t current = 0;
+		int64_t bytes_allocated = 0;
+	};
+
+	ThreeArena(ThreeHeap & heap, int64_t block_size = DefaultBlockSize, void * owner = nullptr);
+	~ThreeArena();
+
+	ThreeArena(ThreeArena const &) = delete;
+	ThreeArena & operator=(ThreeArena const &) = delete;
+
+	// alignment must be a power of 2
+	void * allocate(int64_t size, int alignment = DefaultAlignment);
+
+	Marker getMarker() const;
+	void rewind(Marker const & marker);
+
+	// Return every block to the heap
+	void release();
+
+	int getNumberOfBlocks() const;
+	int64_t getCurrentNumberOfBytesAllocated() const;
+	int64_t getCurrentNumberOfBytesReserved() const;
+
+private:
+
+	struct Block;
+
+	Block * allocateBlock(Block * previous, int64_t size);
+	Block * releaseBlock(Block * block);
+
+private:
+
+	ThreeHeap & heap;
+	int64_t const block_size;
+	void * const owner;
+
+	// blocks are singly linked from the newest back to the oldest, oversized allocations have their own list
+	// so they don't cut the current block short
+	Block * block = nullptr;
+	Block * oversized = nullptr;
+	intptr_t current = 0;
+	intptr_t end = 0;
+
+	int number_of_blocks = 0;
+	int64_t bytes_allocated = 0;
+	int64_t bytes_reserved = 0;
+};
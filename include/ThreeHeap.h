@@ -20,30 +20,41 @@ public:
 
 	struct Flags
 	{
-		THREEHEAP_DEFINE_FLAG(flag_from_new,                0b0000'0000'0000'0000'0001, isNew);
-		THREEHEAP_DEFINE_FLAG(flag_new_scalar,              0b0000'0000'0000'0000'0010, isNewScalar);
-		THREEHEAP_DEFINE_FLAG(flag_new_array,               0b0000'0000'0000'0000'0100, isNewArray);
-		THREEHEAP_DEFINE_FLAG(flag_from_malloc,             0b0000'0000'0000'0001'0000, isMalloc);
-		THREEHEAP_DEFINE_FLAG(flag_malloc_aligned,          0b0000'0000'0000'0010'0000, isMallocAligned);
-		THREEHEAP_DEFINE_FLAG(flag_malloc_calloc,           0b0000'0000'0000'0100'0000, IsMallocCalloc);
-		THREEHEAP_DEFINE_FLAG(flag_malloc_valloc,           0b0000'0000'0000'1000'0000, isMallocValloc);
-
-		THREEHEAP_DEFINE_FLAG(flag_report_allocation,       0b0000'0000'0001'0000'0000, isAllocate);
-		THREEHEAP_DEFINE_FLAG(flag_report_free,             0b0000'0000'0010'0000'0000, isFree);
-
-		THREEHEAP_DEFINE_FLAG(flag_guard_bands,             0b0001'0000'0000'0000'0000, useGuardBands);
-		THREEHEAP_DEFINE_FLAG(flag_fill_guard_bands,        0b0010'0000'0000'0000'0000, fillGuardBands);
-		THREEHEAP_DEFINE_FLAG(flag_fill_frees,              0b0100'0000'0000'0000'0000, fillFrees);
-		THREEHEAP_DEFINE_FLAG(flag_fill_allocations,        0b1000'0000'0000'0000'0000, fillAllocations);
-
-		THREEHEAP_DEFINE_FLAG(flag_validate_guard_bands,    0b0000'0001'0000'0000'0000, validateGuardBands);
-		THREEHEAP_DEFINE_FLAG(flag_validate_free,           0b0000'0100'0000'0000'0000, validateFree);
+		THREEHEAP_DEFINE_FLAG(flag_from_new,                0b0000'0000'0000'0000'0000'0000'0000'0001, isNew);
+		THREEHEAP_DEFINE_FLAG(flag_new_scalar,              0b0000'0000'0000'0000'0000'0000'0000'0010, isNewScalar);
+		THREEHEAP_DEFINE_FLAG(flag_new_array,               0b0000'0000'0000'0000'0000'0000'0000'0100, isNewArray);
+		THREEHEAP_DEFINE_FLAG(flag_from_arena,              0b0000'0000'0000'0000'0000'0000'0000'1000, isArena);
+		THREEHEAP_DEFINE_FLAG(flag_from_malloc,             0b0000'0000'0000'0000'0000'0000'0001'0000, isMalloc);
+		THREEHEAP_DEFINE_FLAG(flag_malloc_aligned,          0b0000'0000'0000'0000'0000'0000'0010'0000, isMallocAligned);
+		THREEHEAP_DEFINE_FLAG(flag_malloc_calloc,           0b0000'0000'0000'0000'0000'0000'0100'0000, IsMallocCalloc);
+		THREEHEAP_DEFINE_FLAG(flag_malloc_valloc,           0b0000'0000'0000'0000'0000'0000'1000'0000, isMallocValloc);
+
+		THREEHEAP_DEFINE_FLAG(flag_report_allocation,       0b0000'0000'0000'0000'0000'0001'0000'0000, isAllocate);
+		THREEHEAP_DEFINE_FLAG(flag_report_free,             0b0000'0000'0000'0000'0000'0010'0000'0000, isFree);
+		THREEHEAP_DEFINE_FLAG(flag_sampled,                 0b0000'0000'0000'0000'0000'0100'0000'0000, isSampled);
+		THREEHEAP_DEFINE_FLAG(flag_track_owners,            0b0000'0000'0000'0000'0000'1000'0000'0000, trackOwners);
+		THREEHEAP_DEFINE_FLAG(flag_track_lifetimes,         0b0000'0000'0001'0000'0000'0000'0000'0000, trackLifetimes);
+		THREEHEAP_DEFINE_FLAG(flag_tree_statistics,         0b0000'0000'0010'0000'0000'0000'0000'0000, treeStatistics);
+		THREEHEAP_DEFINE_FLAG(flag_size_index,              0b0000'0000'1000'0000'0000'0000'0000'0000, useSizeIndex);
+
+		THREEHEAP_DEFINE_FLAG(flag_guard_bands,             0b0000'0000'0000'0001'0000'0000'0000'0000, useGuardBands);
+		THREEHEAP_DEFINE_FLAG(flag_fill_guard_bands,        0b0000'0000'0000'0010'0000'0000'0000'0000, fillGuardBands);
+		THREEHEAP_DEFINE_FLAG(flag_fill_frees,              0b0000'0000'0000'0100'0000'0000'0000'0000, fillFrees);
+		THREEHEAP_DEFINE_FLAG(flag_fill_allocations,        0b0000'0000'0000'1000'0000'0000'0000'0000, fillAllocations);
+		THREEHEAP_DEFINE_FLAG(flag_lazy_fill_frees,         0b0000'0000'0100'0000'0000'0000'0000'0000, lazyFillFrees);
+		THREEHEAP_DEFINE_FLAG(flag_huge_pages,              0b0000'0000'0000'0000'1000'0000'0000'0000, useHugePages);
+
+		THREEHEAP_DEFINE_FLAG(flag_validate_guard_bands,    0b0000'0000'0000'0000'0001'0000'0000'0000, validateGuardBands);
+		THREEHEAP_DEFINE_FLAG(flag_validate_free,           0b0000'0000'0000'0000'0100'0000'0000'0000, validateFree);
+
+		THREEHEAP_DEFINE_FLAG(flag_from_pool,               0b0000'0000'0000'0000'0010'0000'0000'0000, isPool);
 
 		uint32_t flags;
 	};
 
 	THREEHEAP_DECLARE_FLAGS(heap_fast);
 	THREEHEAP_DECLARE_FLAGS(heap_debug);
+	THREEHEAP_DECLARE_FLAGS(sampled_debug);
 
 	THREEHEAP_DECLARE_FLAGS(zero);
 
@@ -54,6 +65,8 @@ public:
 	THREEHEAP_DECLARE_FLAGS(malloc_aligned);
 	THREEHEAP_DECLARE_FLAGS(malloc_aligned_calloc);
 	THREEHEAP_DECLARE_FLAGS(malloc_aligned_valloc);
+	THREEHEAP_DECLARE_FLAGS(arena);
+	THREEHEAP_DECLARE_FLAGS(pool);
 
 	THREEHEAP_DECLARE_FLAGS(free_check);
 
@@ -64,10 +77,20 @@ public:
 	THREEHEAP_DECLARE_FLAGS(fill_guard_bands);
 	THREEHEAP_DECLARE_FLAGS(fill_allocations);
 	THREEHEAP_DECLARE_FLAGS(fill_frees);
+	THREEHEAP_DECLARE_FLAGS(lazy_fill_frees);
+	THREEHEAP_DECLARE_FLAGS(huge_pages);
+	THREEHEAP_DECLARE_FLAGS(size_index);
 
 	THREEHEAP_DECLARE_FLAGS(report_allocation);
 	THREEHEAP_DECLARE_FLAGS(report_free);
 
+	THREEHEAP_DECLARE_FLAGS(track_owners);
+	THREEHEAP_DECLARE_FLAGS(track_lifetimes);
+	THREEHEAP_DECLARE_FLAGS(tree_statistics);
+
+	// allocate() handles alignments up to this many bytes
+	static constexpr int MaximumAlignment = 64;
+
 	struct ErrorInfo
 	{
 		enum class Type
@@ -76,7 +99,12 @@ public:
 			Assert,
 			MismatchedFree,
 			GuardBandCorruption,
-			FreeCorruption
+			FreeCorruption,
+			UseAfterFree,
+			BufferOverflow,
+			DoubleFree,
+			InvalidFree,
+			BufferUnderflow
 		};
 
 		Type type = Type::Unknown;
@@ -93,29 +121,123 @@ public:
 		bool post_guard_band_corrupt[128] = {false};
 
 		int free_corrupt_index = 0;
+		void const * owner = nullptr;
+		void const * fault_address = nullptr;
 
 		Flags allocation_flags = ThreeHeap::zero;
 		Flags free_flags = ThreeHeap::zero;
 
 		// @TODO What else should we include with this
 	};
+	struct OwnerStatistics
+	{
+		void const * owner = nullptr;
+		int current_number_of_allocations = 0;
+		int64_t current_number_of_bytes_allocated = 0;
+		int64_t total_number_of_allocations = 0;
+	};
+	struct LifetimeStatistics
+	{
+		static constexpr int NumberOfBuckets = 48;
+
+		void const * owner = nullptr;
+		int64_t short_lived = 0;
+		int64_t long_lived = 0;
+
+		// frees bucketed by the log2 of the lifetime in timestamp ticks
+		uint32_t histogram[NumberOfBuckets] = {};
+	};
+	struct TreeStatistics
+	{
+		static constexpr int NumberOfBuckets = 32;
+
+		struct Operation
+		{
+			int64_t count = 0;
+			int64_t nodes_visited = 0;
+			int maximum_nodes_visited = 0;
+
+			// operations bucketed by the bit length of the nodes visited
+			uint32_t histogram[NumberOfBuckets] = {};
+		};
+
+		Operation search;
+		Operation insert;
+		Operation remove;
+	};
+	struct TreeShape
+	{
+		static constexpr int NumberOfBuckets = 32;
+
+		int number_of_free_blocks = 0;
+		int number_of_distinct_sizes = 0;
+		int maximum_depth = 0;
+		int64_t total_depth = 0;
+		int maximum_equal_chain = 0;
+
+		// distinct size nodes bucketed by the bit length of their depth and their equal chain length
+		uint32_t depth_histogram[NumberOfBuckets] = {};
+		uint32_t equal_chain_histogram[NumberOfBuckets] = {};
+	};
+	struct HugePageStatistics
+	{
+		// system memory advised for transparent huge pages, and how much of it the kernel actually backs with them
+		int64_t bytes_advised = 0;
+		int64_t bytes_in_huge_pages = 0;
+	};
+	// writeSnapshot() writes a SnapshotHeader followed by one SnapshotRecord per live allocation, in the writer's byte order
+	struct SnapshotRecord
+	{
+		uint64_t address = 0;
+		int64_t size = 0;
+		uint64_t owner = 0;
+		uint64_t stack = 0;     // hash of the heap profile call stack for sampled allocations, 0 if there is none
+		uint32_t flags = 0;
+		uint32_t reserved = 0;
+	};
+	struct SnapshotHeader
+	{
+		static constexpr uint32_t Magic = ('3' << 24) | ('H' << 16) | ('S' << 8) | ('N' << 0);
+		static constexpr uint32_t Version = 1;
+
+		uint32_t magic = Magic;
+		uint32_t version = Version;
+		uint32_t record_size = sizeof(SnapshotRecord);
+		uint32_t reserved = 0;
+		uint64_t timestamp = 0;
+	};
+	// Which of the free blocks that fit an allocation is used
+	enum class PlacementPolicy
+	{
+		BestFit,                // smallest fitting block, the most recently freed first, carving runs of small requests from the victim
+		AddressOrderedBestFit,  // smallest fitting block, the lowest address first, freeing walks the free blocks of the same size
+		FirstFit,               // lowest addressed fitting block
+		NextFit,                // first fitting block after the previous allocation, wrapping around
+		SizeClassBestFit        // best fit with the requests rounded up to size classes
+	};
 	struct ExternalInterface
 	{
 		virtual void tree_fixed_nodes(int64_t * & sizes, int & count ) = 0;
 		virtual void * system_allocator(int64_t & size) = 0;
+		virtual void * system_allocator_aligned(int64_t & size, int64_t alignment);
 		virtual void report_operation(const void * ptr, int64_t size, int alignment, const void * owner, Flags flags) = 0;
 		virtual void report_allocations(const void * ptr, int64_t size, const void * owner, Flags flags) = 0;
 		virtual void error(ErrorInfo const & info) = 0;
 		virtual void terminate() = 0;
+
+		// True when system_allocator returns fresh anonymous memory, which is zero and reads as zero again after MADV_DONTNEED
+		virtual bool system_memory_zeroed() { return false; }
 	};
 	struct DefaultInterface : public ExternalInterface
 	{
 		void tree_fixed_nodes(int64_t * & sizes, int & count ) override;
 		void * system_allocator(int64_t & size) override;
+		void * system_allocator_aligned(int64_t & size, int64_t alignment) override;
 		void report_operation(const void * ptr, int64_t size, int alignment, const void * owner, Flags flags) override;
 		void report_allocations(const void * ptr, int64_t size, const void * owner, Flags flags) override;
 		void error(ErrorInfo const & info) override;
 		void terminate() override;
+		bool system_memory_zeroed() override;
 	};
 
 	ThreeHeap(ExternalInterface & external_interface, Flags enabled);
@@ -135,28 +257,130 @@ public:
 	int64_t getCurrentNumberOfBytesUsed() const;
 	int64_t getMaximumNumberOfBytesUsed() const;
 
+	int64_t getCurrentNumberOfBytesQuarantined() const;
+	int64_t getCurrentNumberOfBytesBinned() const;
+
 	// bool getConfigureFlag(Flags flag) const;
 	// void setConfigureFlag(Flags flag, bool enabled);
 
 	// Interface for C & C++ depending upon the AllocationFlags that get passed in
 	void * allocate(int64_t size, int alignment, Flags flags, void * owner=nullptr);
+
+	// Allocate at least size bytes and return how many the caller may actually use in usable_size
+	void * allocateAtLeast(int64_t size, int alignment, Flags flags, int64_t & usable_size, void * owner=nullptr);
 	void free(void * memory, Flags flags);
 
 	// Reallocate only supports malloc, no alignment, no valloc, no clearing allowed on these blocks
+	// Sizes within the usable size of the current block are done in place, moved allocations keep their owner and free flags
 	void * reallocate(void * memory, int64_t size);
 
 	// Find out the size of an allocation
 	int64_t getAllocationSize(void * memory) const;
 
-	// Change the ownership of the memory to this caller
+	// Find out how many bytes of an allocation the caller may use, including the padding the heap rounded up to
+	int64_t getUsableSize(void * memory) const;
+
+	// Change the ownership of the memory to this caller, memory this heap didn't hand out is reported and nullptr returned
 	void * own(void * memory, void * owner);
 
+	// Find the heap that handed out the memory without reading it, nullptr if no heap owns it
+	static ThreeHeap * findHeap(void const * memory);
+
 	// Verify the internal heap structures (optionally guard bands and free fills too)
 	void verify(Flags flags = zero) const;
 
+	// Verify up to max_blocks blocks, picking up where the last call stopped, returns true when the call finished a lap of the heap.
+	// The free tree, bins and size index are checked at the end of each lap
+	bool verifyStep(int64_t max_blocks, Flags flags = zero);
+
+	// Verify with the system allocations shared out across number_of_threads threads, counting the caller.
+	// The worker threads are kept for the next call, and may report errors to the external interface
+	void verifyParallel(int number_of_threads, Flags flags = zero);
+
+	// Do up to max_bytes of the free fills deferred by lazy_fill_frees, returns the number of bytes filled
+	int64_t flushFreeFills(int64_t max_bytes = INT64_MAX);
+
+	// Hold up to this many bytes of freed blocks out of the free tree to catch use after free, 0 disables the quarantine
+	void setQuarantineSize(int64_t bytes);
+
+	// Verify and release everything in the quarantine
+	void flushQuarantine();
+
+	// Choose how allocations are placed, the free tree is rebuilt to match so this can be changed at any time.
+	// FirstFit and NextFit walk the blocks in address order, so they are only meant for comparing fragmentation
+	void setPlacementPolicy(PlacementPolicy policy);
+
+	// Keep up to this many bytes of small freed blocks in exact size bins, uncoalesced, for reuse by allocations of the same size.
+	// The bins are coalesced back into the free tree when they go over the limit or an allocation misses the tree, 0 disables them
+	void setFastBinLimit(int64_t bytes);
+
+	// Coalesce everything in the fast bins back into the free tree
+	void consolidateFastBins();
+
+	// Relocatable allocation, *handle is the memory's current address which compact() may change while the handle isn't locked
+	using Handle = void * const *;
+
+	// Allocate relocatable memory, nullptr if the handle table is full
+	Handle allocateHandle(int64_t size, Flags flags = malloc, void * owner = nullptr);
+	void freeHandle(Handle handle);
+
+	// Pin the memory where it is until the matching unlock, locks nest
+	void * lockHandle(Handle handle);
+	void unlockHandle(Handle handle);
+
+	// Slide unlocked handle allocations down over the free space between blocks so it collects into larger free blocks,
+	// follow it with purge() to hand the recovered pages back to the system.  Returns the number of bytes moved
+	int64_t compact();
+
+	// Hand the whole pages inside free blocks of at least minimum_size bytes back to the system, returns the number of bytes purged.
+	// Purged blocks are known to be zero, so malloc_calloc allocations from them skip clearing (requires system_memory_zeroed)
+	int64_t purge(int64_t minimum_size = 64 * 1024);
+
+	// Put about 1 in every one_in allocations of a page or less on its own page against a PROT_NONE guard page,
+	// so overflows and use after free fault immediately, 0 disables the sampling
+	void setGuardedSampleRate(int one_in);
+
+	// Add debug_flags (guard bands, fills and their validation) to about 1 in every one_in allocations,
+	// recorded in the block so its free and verify() honor them, 0 disables the sampling
+	void setDebugSampleRate(int one_in, Flags debug_flags = sampled_debug);
+
+	// Run a background thread that takes the heap lock once every milliseconds to do a bounded amount of the deferred
+	// free fills and verify one system allocation with verify_flags, moving on to the next system allocation each tick.
+	// About once a second a lap also consolidates the fast bins and purges the free blocks that were already free on the
+	// previous purge lap.  While the thread runs every public heap call takes the lock, 0 stops the thread
+	void setMaintenanceInterval(int milliseconds, Flags verify_flags = zero);
+
 	// Print outstanding memory allocations
 	void report_allocations() const;
 
+	// Stream every outstanding allocation to fd as a binary snapshot, without allocating from the heap.
+	// Compare two snapshots with the threeheap-diff tool
+	void writeSnapshot(int fd) const;
+
+	// Sample on average one allocation per this many bytes for heap profiling, 0 disables sampling
+	void setProfileSampleInterval(int64_t average_bytes);
+
+	// Write the sampled live heap and cumulative allocations in the pprof legacy heap profile format
+	void writeHeapProfile(int fd) const;
+
+	// Fill in the owners holding the most bytes (requires track_owners), returns how many were filled in
+	int getTopOwners(OwnerStatistics * owners, int count) const;
+
+	// Fill in the owners with the most frees (requires track_lifetimes), splitting them at threshold ticks, returns how many were filled in
+	int getOwnerLifetimes(LifetimeStatistics * lifetimes, int count, uint64_t threshold) const;
+
+	// Timestamp in the same ticks as the lifetimes
+	static uint64_t getTimestamp();
+
+	// Nodes visited by free tree operations (requires tree_statistics)
+	TreeStatistics const & getTreeStatistics() const;
+
+	// Walk the free tree and measure its shape
+	void getTreeShape(TreeShape & shape) const;
+
+	// Measure how much of the heap's system memory is backed by transparent huge pages (requires huge_pages)
+	void getHugePageStatistics(HugePageStatistics & statistics) const;
+
 private:
 
 	struct Block;
@@ -164,30 +388,103 @@ private:
 	struct AllocatedBlock;
 	struct SentinelBlock;
 	struct SystemAllocation;
+	struct Profiler;
+	struct OwnerTable;
+	struct Quarantine;
+	struct GuardedPool;
+	struct SizeIndex;
+	struct HandleTable;
+	struct Maintenance;
+	struct VerifyPool;
 
 private:
 
 	static bool verifyGuardBand(void const * memory, int size, bool * corrupt);
 	void verifyGuardBands(AllocatedBlock const * block) const;
-	void verifyFree(void const * memory, int size) const;
+	void verifyFree(void const * memory, int64_t size, char value) const;
+	void verifyFreeBlock(SystemAllocation const * allocation, Block const * block) const;
 
-	void allocateFromSystem(int64_t minimum_size);
+	AllocatedBlock * getAllocatedBlock(void const * memory) const;
+	AllocatedBlock * findAllocatedBlock(void const * memory, uintptr_t page) const;
+	void reportInvalidFree(void * memory, Flags flags);
 
-	void verify(FreeBlock const * parent, FreeBlock const * node, int & number_of_free_blocks) const;
+	void allocateFromSystem(int64_t minimum_size);
+	SystemAllocation * findSystemAllocation(void const * memory) const;
+	static ThreeHeap * owningHeap(uintptr_t page);
+
+	static void markUnfilled(SystemAllocation * allocation, intptr_t address, int64_t size);
+	static void clearUnfilled(SystemAllocation * allocation, intptr_t address, int64_t size);
+
+	bool verifyBlock(SystemAllocation const * allocation, Block const * block, Flags flags) const;
+	int verifySystemAllocation(SystemAllocation const * allocation, Flags flags) const;
+	int verifyFreeStructures() const;
+	int verifyFreeTree() const;
+	void verifyGuardedPool() const;
+	int64_t purgeSystemAllocation(SystemAllocation * allocation, int64_t minimum_size, bool idle_only = false);
+	void maintain();
 	void removeFromFreeList(FreeBlock * block);
 	void addToFreeList(FreeBlock * block);
 	FreeBlock * searchFreeList(int64_t size);
+	FreeBlock * searchAddressOrder(int64_t size, Block * start);
+	void releaseBlock(AllocatedBlock * block, Flags flags, bool filled);
+
+	void transferOwner(void const * from, void const * to, int64_t size);
+
+	void * allocateGuarded(int64_t size, Flags flags, void * owner);
+	void freeGuarded(void * memory, Flags flags);
+
+	void binBlock(AllocatedBlock * block);
+
+	void quarantineBlock(AllocatedBlock * block);
+	void trimQuarantine();
+	void releaseQuarantined();
+	void recordTreeOperation(TreeStatistics::Operation & operation, int nodes_visited);
+
+	void * allocateMetadata(int64_t size);
+
+	void sampleAllocation(AllocatedBlock * block, void const * memory, int64_t size);
+	void sampleFree(void const * memory);
+
+	OwnerStatistics & ownerStatistics(void const * owner);
+	void recordLifetime(AllocatedBlock const * block, OwnerStatistics const & owner);
 
 private:
 
 	ExternalInterface & external;
 	const Flags heap_flags;
-	const int guard_band_size = 0;
+
+	Flags debug_sample_flags = zero;
+	int debug_sample_rate = 0;
+	int64_t debug_countdown = INT64_MAX;
+	uint64_t debug_random = 0x9e3779b97f4a7c15ull;
 
 	FreeBlock * free_list = nullptr;
+
+	// Dense exact size index holding the smaller free blocks out of the tree (requires size_index)
+	SizeIndex * free_size_index = nullptr;
+
+	// Exact size LIFO lists of small freed blocks, one per Alignment multiple of block size
+	static constexpr int NumberOfFastBins = 16;
+	FreeBlock * fast_bins[NumberOfFastBins] = {};
+	int64_t fast_bin_bytes = 0;
+	int64_t fast_bin_limit = 256 * 1024;
+
+	// The most recent split remainder, kept out of the tree so sequential allocations are carved from it in address order
+	FreeBlock * victim = nullptr;
+
+	PlacementPolicy placement = PlacementPolicy::BestFit;
+
+	// Where NextFit resumes its walk, kept pointing at a live block as blocks coalesce
+	Block * next_fit = nullptr;
+
 	SystemAllocation * first_system_allocation = nullptr;
 	SystemAllocation * last_system_allocation = nullptr;
 
+	int64_t huge_page_bytes_advised = 0;
+
+	SystemAllocation * flush_allocation = nullptr;
+	int64_t flush_granule = 0;
+
 	int total_number_of_allocations = 0;
 	int total_number_of_frees = 0;
 	int current_number_of_allocations = 0;
@@ -204,6 +501,31 @@ private:
 
 	int fixed_nodes_count = 0;
 	int64_t * fixed_node_sizes = nullptr;
+
+	intptr_t metadata_current = 0;
+	intptr_t metadata_end = 0;
+
+	Profiler * profiler = nullptr;
+	int64_t profile_bytes_until_sample = INT64_MAX;
+
+	OwnerTable * owner_table = nullptr;
+
+	Quarantine * quarantine = nullptr;
+
+	GuardedPool * guarded_pool = nullptr;
+	int64_t guarded_countdown = INT64_MAX;
+
+	HandleTable * handle_table = nullptr;
+
+	Maintenance * maintenance = nullptr;
+
+	// Where verifyStep() resumes, kept pointing at a live block as blocks coalesce
+	SystemAllocation * verify_allocation = nullptr;
+	Block const * verify_block = nullptr;
+
+	VerifyPool * verify_pool = nullptr;
+
+	TreeStatistics free_tree_statistics;
 private:
 
 	ThreeHeap(const ThreeHeap &) = delete;
@@ -269,6 +591,11 @@ inline int64_t ThreeHeap::getMaximumNumberOfBytesUsed() const
 	return maximum_bytes_used;
 }
 
+inline ThreeHeap::TreeStatistics const & ThreeHeap::getTreeStatistics() const
+{
+	return free_tree_statistics;
+}
+
 inline ThreeHeap::Flags operator|(ThreeHeap::Flags const & lhs, ThreeHeap::Flags const & rhs)
 {
 	return ThreeHeap::Flags{lhs.flags | rhs.flags};
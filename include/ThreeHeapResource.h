@@ -0,0 +1,227 @@
+#pragma once
+
+#include <ThreeArena.h>
+#include <ThreeHeap.h>
+
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+// ======================================================================
+
+// Alignments beyond what the heap supports are handled by over allocating and keeping the heap's
+// pointer just in front of the aligned memory
+inline void * ThreeHeapAllocate(ThreeHeap & heap, int64_t const size, int const alignment, ThreeHeap::Flags const flags, void * const owner)
+{
+	if (alignment <= ThreeHeap::MaximumAlignment)
+		return heap.allocate(size, alignment, flags, owner);
+
+	void * const memory = heap.allocate(size + alignment, 0, flags, owner);
+	intptr_t const aligned = (reinterpret_cast<intptr_t>(memory) + alignment) & ~static_cast<intptr_t>(alignment - 1);
+	reinterpret_cast<void **>(aligned)[-1] = memory;
+	return reinterpret_cast<void *>(aligned);
+}
+
+inline void ThreeHeapFree(ThreeHeap & heap, void * const memory, int const alignment, ThreeHeap::Flags const flags)
+{
+	if (alignment <= ThreeHeap::MaximumAlignment)
+		heap.free(memory, flags);
+	else
+		heap.free(reinterpret_cast<void **>(memory)[-1], flags);
+}
+
+// ======================================================================
+
+// Polymorphic memory resource over a ThreeHeap, every allocation is tagged with the resource's owner
+class ThreeHeapResource : public std::pmr::memory_resource
+{
+public:
+
+	ThreeHeapResource(ThreeHeap & heap, void * owner = nullptr, ThreeHeap::Flags flags = ThreeHeap::malloc);
+
+	ThreeHeap & getHeap() const;
+
+private:
+
+	void * do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void * memory, size_t bytes, size_t alignment) override;
+	bool do_is_equal(std::pmr::memory_resource const & other) const noexcept override;
+
+private:
+
+	ThreeHeap & heap;
+	void * const owner;
+	ThreeHeap::Flags const flags;
+};
+
+// Polymorphic memory resource over a ThreeArena, deallocation is a no-op until the arena is rewound or released
+// (defined in ThreeArena.cpp, so only programs using arenas need to link it)
+class ThreeArenaResource : public std::pmr::memory_resource
+{
+public:
+
+	explicit ThreeArenaResource(ThreeArena & arena);
+
+	ThreeArena & getArena() const;
+
+private:
+
+	void * do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void * memory, size_t bytes, size_t alignment) override;
+	bool do_is_equal(std::pmr::memory_resource const & other) const noexcept override;
+
+private:
+
+	ThreeArena & arena;
+};
+
+// ======================================================================
+
+// Same members as the C++23 std::allocation_result
+template <typename T>
+struct ThreeHeapAllocationResult
+{
+	T * ptr;
+	size_t count;
+};
+
+// Stateful allocator for standard containers, every allocation is tagged with the allocator's owner
+template <typename T>
+class ThreeHeapAllocator
+{
+public:
+
+	using value_type = T;
+
+	ThreeHeapAllocator(ThreeHeap & heap, void * owner = nullptr);
+
+	template <typename U>
+	ThreeHeapAllocator(ThreeHeapAllocator<U> const & other);
+
+	T * allocate(size_t count);
+	void deallocate(T * memory, size_t count);
+
+	// Allocate at least count objects, and report how many fit in the memory the heap actually handed out
+	ThreeHeapAllocationResult<T> allocate_at_least(size_t count);
+
+	ThreeHeap & getHeap() const;
+
+private:
+
+	template <typename> friend class ThreeHeapAllocator;
+
+	static int64_t getSize(size_t count);
+
+private:
+
+	ThreeHeap * heap;
+	void * owner;
+};
+
+template <typename T, typename U>
+bool operator==(ThreeHeapAllocator<T> const & lhs, ThreeHeapAllocator<U> const & rhs);
+
+template <typename T, typename U>
+bool operator!=(ThreeHeapAllocator<T> const & lhs, ThreeHeapAllocator<U> const & rhs);
+
+// ======================================================================
+
+inline ThreeHeapResource::ThreeHeapResource(ThreeHeap & parent_heap, void * const resource_owner, ThreeHeap::Flags const allocation_flags)
+:
+	heap(parent_heap),
+	owner(resource_owner ? resource_owner : this),
+	flags(allocation_flags)
+{
+}
+
+inline ThreeHeap & ThreeHeapResource::getHeap() const
+{
+	return heap;
+}
+
+inline void * ThreeHeapResource::do_allocate(size_t const bytes, size_t const alignment)
+{
+	return ThreeHeapAllocate(heap, bytes, static_cast<int>(alignment), flags, owner);
+}
+
+inline void ThreeHeapResource::do_deallocate(void * const memory, size_t, size_t const alignment)
+{
+	ThreeHeapFree(heap, memory, static_cast<int>(alignment), flags);
+}
+
+inline bool ThreeHeapResource::do_is_equal(std::pmr::memory_resource const & other) const noexcept
+{
+	// Memory from any resource over the same heap and flags can be freed by this one
+	ThreeHeapResource const * const resource = dynamic_cast<ThreeHeapResource const *>(&other);
+	return resource && &resource->heap == &heap && resource->flags == flags;
+}
+
+// ======================================================================
+
+template <typename T>
+ThreeHeapAllocator<T>::ThreeHeapAllocator(ThreeHeap & parent_heap, void * const allocator_owner)
+:
+	heap(&parent_heap),
+	owner(allocator_owner)
+{
+}
+
+template <typename T>
+template <typename U>
+ThreeHeapAllocator<T>::ThreeHeapAllocator(ThreeHeapAllocator<U> const & other)
+:
+	heap(other.heap),
+	owner(other.owner)
+{
+}
+
+template <typename T>
+T * ThreeHeapAllocator<T>::allocate(size_t const count)
+{
+	return static_cast<T *>(ThreeHeapAllocate(*heap, getSize(count), alignof(T), ThreeHeap::malloc, owner));
+}
+
+template <typename T>
+void ThreeHeapAllocator<T>::deallocate(T * const memory, size_t)
+{
+	ThreeHeapFree(*heap, memory, alignof(T), ThreeHeap::malloc);
+}
+
+template <typename T>
+ThreeHeapAllocationResult<T> ThreeHeapAllocator<T>::allocate_at_least(size_t const count)
+{
+	// Over aligned allocations don't start at the heap's pointer, so only the requested count is known to fit
+	if (alignof(T) > ThreeHeap::MaximumAlignment)
+		return { allocate(count), count };
+
+	int64_t usable_size = 0;
+	T * const memory = static_cast<T *>(heap->allocateAtLeast(getSize(count), alignof(T), ThreeHeap::malloc, usable_size, owner));
+	return { memory, static_cast<size_t>(usable_size) / sizeof(T) };
+}
+
+template <typename T>
+ThreeHeap & ThreeHeapAllocator<T>::getHeap() const
+{
+	return *heap;
+}
+
+template <typename T>
+int64_t ThreeHeapAllocator<T>::getSize(size_t const count)
+{
+	// Counts whose size the heap can't represent are rejected the same way new[] rejects them
+	if (count > static_cast<size_t>(std::numeric_limits<int64_t>::max()) / sizeof(T))
+		throw std::bad_array_new_length();
+	return static_cast<int64_t>(count * sizeof(T));
+}
+
+template <typename T, typename U>
+bool operator==(ThreeHeapAllocator<T> const & lhs, ThreeHeapAllocator<U> const & rhs)
+{
+	return &lhs.getHeap() == &rhs.getHeap();
+}
+
+template <typename T, typename U>
+bool operator!=(ThreeHeapAllocator<T> const & lhs, ThreeHeapAllocator<U> const & rhs)
+{
+	return &lhs.getHeap() != &rhs.getHeap();
+}
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <ThreeHeap.h>
+
+#include <mutex>
+#include <new>
+#include <utility>
+
+// ======================================================================
+
+// Fixed size pool of T carved out of slabs taken from a ThreeHeap.  Free objects are kept on an intrusive
+// free list, so create() and destroy() are O(1) and there is no header per object.  The slabs are allocated
+// with the pool flags and owned by the pool, so they show up in the heap's statistics and report_allocations().
+//
+// The pool is guarded by its own lock, and a thread can keep a Cache to skip the lock for most operations.
+// Slabs are only allocated and freed under that lock, the heap itself must not be used concurrently elsewhere.
+template <typename T>
+class ThreePool
+{
+public:
+
+	static constexpr int DefaultObjectsPerSlab = 256;
+
+	ThreePool(ThreeHeap & heap, void * owner = nullptr, int objects_per_slab = DefaultObjectsPerSlab);
+	~ThreePool();
+
+	ThreePool(ThreePool const &) = delete;
+	ThreePool & operator=(ThreePool const &) = delete;
+
+	template <typename... Arguments>
+	T * create(Arguments &&... arguments);
+	void destroy(T * object);
+
+	// Per thread cache of free objects, exchanged with the pool in batches.  Its counts are only folded
+	// into the pool's statistics at those exchanges, so the statistics lag by up to a batch per cache.
+	class Cache
+	{
+	public:
+
+		static constexpr int Capacity = 64;
+
+		explicit Cache(ThreePool & pool);
+		~Cache();
+
+		Cache(Cache const &) = delete;
+		Cache & operator=(Cache const &) = delete;
+
+		template <typename... Arguments>
+		T * create(Arguments &&... arguments);
+		void destroy(T * object);
+
+		// Hand every cached object back to the pool
+		void flush();
+
+	private:
+
+		ThreePool & pool;
+		void * free_list = nullptr;
+		int number_free = 0;
+		int number_of_allocations = 0;
+		int number_of_frees = 0;
+	};
+
+	int getTotalNumberOfFrees() const;
+	int getTotalNumberOfAllocations() const;
+	int getCurrentNumberOfAllocations() const;
+	int getMaximumNumberOfAllocations() const;
+
+	int64_t getTotalNumberOfBytesAllocated() const;
+	int64_t getCurrentNumberOfBytesAllocated() const;
+	int64_t getMaximumNumberOfBytesAllocated() const;
+
+	int64_t getCurrentNumberOfBytesFree() const;
+	int64_t getCurrentNumberOfBytesUsed() const;
+
+private:
+
+	// Free objects hold the next free object in their first bytes
+	union Slot
+	{
+		Slot * next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	// Slabs are allocated aligned for their slots, which the heap can only do up to its maximum alignment
+	static_assert(alignof(Slot) <= ThreeHeap::MaximumAlignment);
+
+	struct Slab
+	{
+		Slab * next;
+	};
+
+	static constexpr int64_t SlabHeaderSize = (sizeof(Slab) + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+
+	void * allocateSlot();
+	void freeSlot(void * slot);
+	void allocateSlab();
+
+	// Move free slots between a cache and the pool, folding in the cache's counts
+	void take(void * & list, int count, int number_of_allocations, int number_of_frees);
+	void give(void * list, int count, int number_of_allocations, int number_of_frees);
+	void account(int number_of_allocations, int number_of_frees);
+
+private:
+
+	ThreeHeap & heap;
+	void * const owner;
+	int const objects_per_slab;
+
+	std::mutex mutex;
+	Slot * free_list = nullptr;
+	Slab * slabs = nullptr;
+
+	int number_of_slabs = 0;
+	int number_free = 0;
+
+	int total_number_of_allocations = 0;
+	int total_number_of_frees = 0;
+	int current_number_of_allocations = 0;
+	int maximum_number_of_allocations = 0;
+};
+
+// ======================================================================
+
+template <typename T>
+ThreePool<T>::ThreePool(ThreeHeap & parent_heap, void * const pool_owner, int const slab_objects)
+:
+	heap(parent_heap),
+	owner(pool_owner ? pool_owner : this),
+	objects_per_slab(slab_objects)
+{
+}
+
+template <typename T>
+ThreePool<T>::~ThreePool()
+{
+	// Objects still alive at this point are released along with their slabs without being destroyed
+	while (slabs)
+	{
+		Slab * const next = slabs->next;
+		heap.free(slabs, ThreeHeap::pool);
+		slabs = next;
+	}
+}
+
+template <typename T>
+template <typename... Arguments>
+T * ThreePool<T>::create(Arguments &&... arguments)
+{
+	void * slot;
+	{
+		std::lock_guard<std::mutex> const lock(mutex);
+		slot = allocateSlot();
+		account(1, 0);
+	}
+	return new(slot) T(std::forward<Arguments>(arguments)...);
+}
+
+template <typename T>
+void ThreePool<T>::destroy(T * const object)
+{
+	if (!object)
+		return;
+
+	object->~T();
+	std::lock_guard<std::mutex> const lock(mutex);
+	freeSlot(object);
+	account(0, 1);
+}
+
+template <typename T>
+void * ThreePool<T>::allocateSlot()
+{
+	if (!free_list)
+		allocateSlab();
+
+	Slot * const slot = free_list;
+	free_list = slot->next;
+	--number_free;
+	return slot;
+}
+
+template <typename T>
+void ThreePool<T>::freeSlot(void * const memory)
+{
+	Slot * const slot = static_cast<Slot *>(memory);
+	slot->next = free_list;
+	free_list = slot;
+	++number_free;
+}
+
+template <typename T>
+void ThreePool<T>::allocateSlab()
+{
+	int64_t const size = SlabHeaderSize + objects_per_slab * static_cast<int64_t>(sizeof(Slot));
+	Slab * const slab = static_cast<Slab *>(heap.allocate(size, alignof(Slot), ThreeHeap::pool, owner));
+	slab->next = slabs;
+	slabs = slab;
+	++number_of_slabs;
+
+	// Thread the new slots onto the free list in address order
+	Slot * const first = reinterpret_cast<Slot *>(reinterpret_cast<intptr_t>(slab) + SlabHeaderSize);
+	for (int i = objects_per_slab - 1; i >= 0; --i)
+		freeSlot(first + i);
+}
+
+template <typename T>
+void ThreePool<T>::take(void * & list, int const count, int const number_of_allocations, int const number_of_frees)
+{
+	std::lock_guard<std::mutex> const lock(mutex);
+	for (int i = 0; i < count; ++i)
+	{
+		Slot * const slot = static_cast<Slot *>(allocateSlot());
+		slot->next = static_cast<Slot *>(list);
+		list = slot;
+	}
+	account(number_of_allocations, number_of_frees);
+}
+
+template <typename T>
+void ThreePool<T>::give(void * list, int const count, int const number_of_allocations, int const number_of_frees)
+{
+	std::lock_guard<std::mutex> const lock(mutex);
+	for (int i = 0; i < count; ++i)
+	{
+		Slot * const slot = static_cast<Slot *>(list);
+		list = slot->next;
+		freeSlot(slot);
+	}
+	account(number_of_allocations, number_of_frees);
+}
+
+template <typename T>
+void ThreePool<T>::account(int const number_of_allocations, int const number_of_frees)
+{
+	total_number_of_allocations += number_of_allocations;
+	total_number_of_frees += number_of_frees;
+	current_number_of_allocations += number_of_allocations - number_of_frees;
+	if (current_number_of_allocations > maximum_number_of_allocations)
+		maximum_number_of_allocations = current_number_of_allocations;
+}
+
+// ======================================================================
+
+template <typename T>
+ThreePool<T>::Cache::Cache(ThreePool & parent_pool)
+:
+	pool(parent_pool)
+{
+}
+
+template <typename T>
+ThreePool<T>::Cache::~Cache()
+{
+	flush();
+}
+
+template <typename T>
+template <typename... Arguments>
+T * ThreePool<T>::Cache::create(Arguments &&... arguments)
+{
+	// Refill half the cache at a time so alternating create and destroy don't go back to the pool every time
+	if (!free_list)
+	{
+		pool.take(free_list, Capacity / 2, number_of_allocations, number_of_frees);
+		number_free = Capacity / 2;
+		number_of_allocations = 0;
+		number_of_frees = 0;
+	}
+
+	Slot * const slot = static_cast<Slot *>(free_list);
+	free_list = slot->next;
+	--number_free;
+	++number_of_allocations;
+	return new(slot) T(std::forward<Arguments>(arguments)...);
+}
+
+template <typename T>
+void ThreePool<T>::Cache::destroy(T * const object)
+{
+	if (!object)
+		return;
+
+	object->~T();
+	Slot * const slot = reinterpret_cast<Slot *>(object);
+	slot->next = static_cast<Slot *>(free_list);
+	free_list = slot;
+	++number_free;
+	++number_of_frees;
+
+	// Give back the older half once the cache is full
+	if (number_free == Capacity)
+	{
+		Slot * keep = static_cast<Slot *>(free_list);
+		for (int i = 1; i < Capacity / 2; ++i)
+			keep = keep->next;
+		void * const excess = keep->next;
+		keep->next = nullptr;
+		number_free = Capacity / 2;
+
+		pool.give(excess, Capacity / 2, number_of_allocations, number_of_frees);
+		number_of_allocations = 0;
+		number_of_frees = 0;
+	}
+}
+
+template <typename T>
+void ThreePool<T>::Cache::flush()
+{
+	pool.give(free_list, number_free, number_of_allocations, number_of_frees);
+	free_list = nullptr;
+	number_free = 0;
+	number_of_allocations = 0;
+	number_of_frees = 0;
+}
+
+// ======================================================================
+
+template <typename T>
+inline int ThreePool<T>::getTotalNumberOfFrees() const
+{
+	return total_number_of_frees;
+}
+
+template <typename T>
+inline int ThreePool<T>::getTotalNumberOfAllocations() const
+{
+	return total_number_of_allocations;
+}
+
+template <typename T>
+inline int ThreePool<T>::getCurrentNumberOfAllocations() const
+{
+	return current_number_of_allocations;
+}
+
+template <typename T>
+inline int ThreePool<T>::getMaximumNumberOfAllocations() const
+{
+	return maximum_number_of_allocations;
+}
+
+template <typename T>
+inline int64_t ThreePool<T>::getTotalNumberOfBytesAllocated() const
+{
+	return total_number_of_allocations * static_cast<int64_t>(sizeof(T));
+}
+
+template <typename T>
+inline int64_t ThreePool<T>::getCurrentNumberOfBytesAllocated() const
+{
+	return current_number_of_allocations * static_cast<int64_t>(sizeof(T));
+}
+
+template <typename T>
+inline int64_t ThreePool<T>::getMaximumNumberOfBytesAllocated() const
+{
+	return maximum_number_of_allocations * static_cast<int64_t>(sizeof(T));
+}
+
+template <typename T>
+inline int64_t ThreePool<T>::getCurrentNumberOfBytesFree() const
+{
+	return number_free * static_cast<int64_t>(sizeof(Slot));
+}
+
+template <typename T>
+inline int64_t ThreePool<T>::getCurrentNumberOfBytesUsed() const
+{
+	return number_of_slabs * (SlabHeaderSize + objects_per_slab * static_cast<int64_t>(sizeof(Slot)));
+}
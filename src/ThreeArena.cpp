@@ -0,0 +1,168 @@
+#include <ThreeArena.h>
+#include <ThreeHeapResource.h>
+
+#include <new>
+
+#include <assert.h>
+
+// ======================================================================
+
+struct ThreeArena::Block
+{
+	Block * previous = nullptr;
+	int64_t size = 0;
+};
+
+namespace
+{
+	// Keeps the first allocation in each block at the default alignment
+	constexpr int64_t BlockHeaderSize = 2 * ThreeArena::DefaultAlignment;
+
+	// Allocations bigger than this fraction of a block get a block of their own
+	constexpr int64_t OversizedFraction = 4;
+}
+
+// ======================================================================
+
+ThreeArena::ThreeArena(ThreeHeap & parent_heap, int64_t const size, void * const arena_owner)
+:
+	heap(parent_heap),
+	block_size(size),
+	owner(arena_owner ? arena_owner : this)
+{
+}
+
+ThreeArena::~ThreeArena()
+{
+	release();
+}
+
+void * ThreeArena::allocate(int64_t const size, int const alignment)
+{
+	assert((alignment & (alignment - 1)) == 0);
+	intptr_t const mask = alignment - 1;
+	bytes_allocated += size;
+
+	if (size + alignment > block_size / OversizedFraction)
+	{
+		oversized = allocateBlock(oversized, BlockHeaderSize + size + alignment);
+		return reinterpret_cast<void *>((reinterpret_cast<intptr_t>(oversized) + BlockHeaderSize + mask) & ~mask);
+	}
+
+	// Zero sized allocations still need a block to point into, before the first one current and end are both 0
+	intptr_t result = (current + mask) & ~mask;
+	if (!block || result + size > end)
+	{
+		block = allocateBlock(block, BlockHeaderSize + block_size);
+		current = reinterpret_cast<intptr_t>(block) + BlockHeaderSize;
+		end = reinterpret_cast<intptr_t>(block) + block->size;
+		result = (current + mask) & ~mask;
+	}
+
+	current = result + size;
+	return reinterpret_cast<void *>(result);
+}
+
+ThreeArena::Block * ThreeArena::allocateBlock(Block * const previous, int64_t const size)
+{
+	Block * const next = new(heap.allocate(size, 0, ThreeHeap::arena, owner)) Block();
+	next->previous = previous;
+	next->size = size;
+
+	++number_of_blocks;
+	bytes_reserved += size;
+	return next;
+}
+
+ThreeArena::Block * ThreeArena::releaseBlock(Block * const released)
+{
+	Block * const previous = released->previous;
+	--number_of_blocks;
+	bytes_reserved -= released->size;
+	heap.free(released, ThreeHeap::arena);
+	return previous;
+}
+
+ThreeArena::Marker ThreeArena::getMarker() const
+{
+	Marker marker;
+	marker.block = block;
+	marker.oversized = oversized;
+	marker.current = current;
+	marker.bytes_allocated = bytes_allocated;
+	return marker;
+}
+
+void ThreeArena::rewind(Marker const & marker)
+{
+	// Blocks newer than the marker's go back to the heap, the marker's block is reused from the marker on
+	while (block != marker.block)
+	{
+		assert(block);
+		block = releaseBlock(block);
+	}
+	while (oversized != marker.oversized)
+	{
+		assert(oversized);
+		oversized = releaseBlock(oversized);
+	}
+
+	current = marker.current;
+	end = block ? reinterpret_cast<intptr_t>(block) + block->size : 0;
+	bytes_allocated = marker.bytes_allocated;
+}
+
+void ThreeArena::release()
+{
+	while (block)
+		block = releaseBlock(block);
+	while (oversized)
+		oversized = releaseBlock(oversized);
+
+	current = 0;
+	end = 0;
+	bytes_allocated = 0;
+}
+
+int ThreeArena::getNumberOfBlocks() const
+{
+	return number_of_blocks;
+}
+
+int64_t ThreeArena::getCurrentNumberOfBytesAllocated() const
+{
+	return bytes_allocated;
+}
+
+int64_t ThreeArena::getCurrentNumberOfBytesReserved() const
+{
+	return bytes_reserved;
+}
+
+// ======================================================================
+
+ThreeArenaResource::ThreeArenaResource(ThreeArena & parent_arena)
+:
+	arena(parent_arena)
+{
+}
+
+ThreeArena & ThreeArenaResource::getArena() const
+{
+	return arena;
+}
+
+void * ThreeArenaResource::do_allocate(size_t const bytes, size_t const alignment)
+{
+	return arena.allocate(bytes, static_cast<int>(alignment));
+}
+
+void ThreeArenaResource::do_deallocate(void *, size_t, size_t)
+{
+}
+
+bool ThreeArenaResource::do_is_equal(std::pmr::memory_resource const & other) const noexcept
+{
+	ThreeArenaResource const * const resource = dynamic_cast<ThreeArenaResource const *>(&other);
+	return resource && &resource->arena == &arena;
+}
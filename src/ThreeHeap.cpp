@@ -1,11 +1,23 @@
 #include <ThreeHeap.h>
 
 #include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <immintrin.h>
+#include <x86intrin.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <new>
+#include <thread>
 
 // ======================================================================
 
@@ -20,6 +32,20 @@
 #define USE_VERIFY_GUARD_BANDS           1
 #define USE_VERIFY_FREES                 1
 
+#define USE_QUARANTINE                   1
+#define USE_GUARDED_SAMPLING             1
+#define USE_DESIGNATED_VICTIM            1
+#define USE_FAST_BINS                    1
+#define USE_SIZE_INDEX                   1
+#define USE_HANDLES                      1
+#define USE_MAINTENANCE                  1
+#define USE_PARALLEL_VERIFY              1
+
+#define USE_HEAP_PROFILE                 1
+#define USE_OWNER_STATISTICS             1
+#define USE_LIFETIME_STATISTICS          1
+#define USE_TREE_STATISTICS              1
+
 // #define USE_ALLOCATION_STACK_DEPTH       0
 
 #if USE_ASSERT
@@ -51,6 +77,17 @@
 	#define REPORT_OPERATION(...) static_cast<void>(0)
 #endif
 
+#if USE_TREE_STATISTICS
+	#define TREE_OPERATION(operation, nodes_visited) \
+		do \
+		{ \
+			if (heap_flags.treeStatistics()) \
+				recordTreeOperation(free_tree_statistics.operation, nodes_visited); \
+		} while (false)
+#else
+	#define TREE_OPERATION(operation, nodes_visited) static_cast<void>(nodes_visited)
+#endif
+
 #define THREEHEAP_DEFINE_FLAGS1(flags_name, flags0) \
 	const ThreeHeap::Flags ThreeHeap::flags_name{ThreeHeap::Flags::flags0}
 
@@ -63,9 +100,13 @@
 #define THREEHEAP_DEFINE_FLAGS4(flags_name, flags0, flags1, flags2, flags3) \
 	const ThreeHeap::Flags ThreeHeap::flags_name{ThreeHeap::Flags::flags0 | ThreeHeap::Flags::flags1 | ThreeHeap::Flags::flags2 | ThreeHeap::Flags::flags3}
 
+#define THREEHEAP_DEFINE_FLAGS6(flags_name, flags0, flags1, flags2, flags3, flags4, flags5) \
+	const ThreeHeap::Flags ThreeHeap::flags_name{ThreeHeap::Flags::flags0 | ThreeHeap::Flags::flags1 | ThreeHeap::Flags::flags2 | ThreeHeap::Flags::flags3 | ThreeHeap::Flags::flags4 | ThreeHeap::Flags::flags5}
+
 const ThreeHeap::Flags ThreeHeap::zero{0};
 const ThreeHeap::Flags ThreeHeap::heap_fast = zero;
-const ThreeHeap::Flags ThreeHeap::heap_debug = guard_bands | validate_guard_bands | fill_allocations | fill_guard_bands | fill_frees;
+const ThreeHeap::Flags ThreeHeap::heap_debug = guard_bands | validate_guard_bands | fill_allocations | fill_guard_bands | fill_frees | tree_statistics;
+const ThreeHeap::Flags ThreeHeap::sampled_debug = guard_bands | validate_guard_bands | fill_allocations | fill_guard_bands | fill_frees | validate_free;
 
 THREEHEAP_DEFINE_FLAGS2(new_scalar, flag_from_new, flag_new_scalar);
 THREEHEAP_DEFINE_FLAGS2(new_array, flag_from_new, flag_new_array);
@@ -75,7 +116,10 @@ THREEHEAP_DEFINE_FLAGS2(malloc_aligned, flag_from_malloc, flag_malloc_aligned);
 THREEHEAP_DEFINE_FLAGS2(malloc_aligned_calloc, flag_from_malloc, flag_malloc_calloc);
 THREEHEAP_DEFINE_FLAGS2(malloc_aligned_valloc, flag_from_malloc, flag_malloc_valloc);
 
-THREEHEAP_DEFINE_FLAGS4(free_check, flag_from_new, flag_new_scalar, flag_new_array, flag_from_malloc);
+THREEHEAP_DEFINE_FLAGS1(arena, flag_from_arena);
+THREEHEAP_DEFINE_FLAGS1(pool, flag_from_pool);
+
+THREEHEAP_DEFINE_FLAGS6(free_check, flag_from_new, flag_new_scalar, flag_new_array, flag_from_malloc, flag_from_arena, flag_from_pool);
 THREEHEAP_DEFINE_FLAGS1(guard_bands, flag_guard_bands);
 
 THREEHEAP_DEFINE_FLAGS1(validate_guard_bands,flag_validate_guard_bands);
@@ -84,10 +128,17 @@ THREEHEAP_DEFINE_FLAGS1(validate_free	, flag_validate_free);
 THREEHEAP_DEFINE_FLAGS1(fill_guard_bands, flag_fill_guard_bands);
 THREEHEAP_DEFINE_FLAGS1(fill_allocations, flag_fill_allocations);
 THREEHEAP_DEFINE_FLAGS1(fill_frees, flag_fill_frees);
+THREEHEAP_DEFINE_FLAGS2(lazy_fill_frees, flag_fill_frees, flag_lazy_fill_frees);
+THREEHEAP_DEFINE_FLAGS1(huge_pages, flag_huge_pages);
+THREEHEAP_DEFINE_FLAGS1(size_index, flag_size_index);
 
 THREEHEAP_DEFINE_FLAGS1(report_allocation, flag_report_allocation);
 THREEHEAP_DEFINE_FLAGS1(report_free, flag_report_free);
 
+THREEHEAP_DEFINE_FLAGS1(track_owners, flag_track_owners);
+THREEHEAP_DEFINE_FLAGS2(track_lifetimes, flag_track_owners, flag_track_lifetimes);
+THREEHEAP_DEFINE_FLAGS1(tree_statistics, flag_tree_statistics);
+
 // ======================================================================
 
 namespace
@@ -96,21 +147,45 @@ namespace
 	constexpr static size_t AllocationPad = Alignment;
 	constexpr static size_t HeaderSize = Alignment;
 	constexpr static size_t SplitSize = HeaderSize * 2;
+
+	// Blocks up to this size are small enough to be carved from the designated victim
+	constexpr static int64_t VictimMaximumSize = 16 * Alignment;
 	constexpr static size_t GuardBandSize = 64;
 
 	constexpr static char GuardBandFillChar = 0xab;
 	constexpr static char AllocationFillChar = 0xcd;
 	constexpr static char FreeFillChar = 0xef;
 
+	// Fills larger than these bypass the cache so debug fills don't evict the working set.
+	// Allocation fills are about to be overwritten by the client, so they only stream
+	// when the block wouldn't stay in the cache anyway.
+	constexpr static int64_t NonTemporalFillSize = 32 * 1024;
+	constexpr static int64_t NonTemporalAllocationFillSize = 1024 * 1024;
+
+	// Granularity of purging memory back to the system
+	constexpr static intptr_t SystemPageSize = 4096;
+	constexpr static intptr_t HugePageSize = 2 * 1024 * 1024;
+
 	// Alignment needs to be a power of 2
 	static_assert((Alignment & (Alignment-1)) == 0);
+	static_assert(Alignment == ThreeHeap::MaximumAlignment);
+
+	// What the memory after a free block's header holds
+	enum class BlockContents : uint8_t
+	{
+		Unknown,
+		FreeFilled, // or waiting for its fill in the unfilled bitmap
+		Zero
+	};
 
-	enum class BlockStatus : int16_t
+	enum class BlockStatus : int8_t
 	{
 		Unknown,
 		Free,
 		Allocated,
-		Sentinel
+		Sentinel,
+		Quarantined,
+		Binned
 	};
 
 	const char *GetAllocFlags(ThreeHeap::Flags flags)
@@ -125,6 +200,12 @@ namespace
 		if (flags == ThreeHeap::new_array) {
 			return "new[]";
 		}
+		if (flags == ThreeHeap::arena) {
+			return "arena";
+		}
+		if (flags == ThreeHeap::pool) {
+			return "pool";
+		}
 		return "invalid";
 	}
 
@@ -140,6 +221,12 @@ namespace
 		if (flags == ThreeHeap::new_array) {
 			return "delete[]";
 		}
+		if (flags == ThreeHeap::arena) {
+			return "arena release";
+		}
+		if (flags == ThreeHeap::pool) {
+			return "pool release";
+		}
 		return "invalid";
 	}
 
@@ -148,25 +235,399 @@ namespace
 		int const mask = alignment - 1;
 		return (alignment - (size & mask)) & mask; 
 	}
+
+	// Block sizes above 1kb are rounded up to one of 4 classes per power of 2, wasting at most a quarter of the block
+	int64_t SizeClass(int64_t const block_size)
+	{
+		if (block_size <= 1024)
+			return block_size;
+		int64_t const step = int64_t(1) << (63 - __builtin_clzll(block_size - 1) - 2);
+		return (block_size + step - 1) & ~(step - 1);
+	}
+
+	// Fill pattern checks return the index of the first byte that doesn't match, or size if they all do
+	using FindMismatchFunction = int64_t (*)(char const * memory, int64_t size, char value);
+
+	int64_t FindMismatchScalar(char const * const memory, int64_t const size, char const value)
+	{
+		for (int64_t i = 0; i < size; ++i)
+			if (memory[i] != value)
+				return i;
+		return size;
+	}
+
+	int64_t FindMismatchSse2(char const * const memory, int64_t const size, char const value)
+	{
+		__m128i const pattern = _mm_set1_epi8(value);
+		int64_t i = 0;
+		for (; i + 64 <= size; i += 64)
+		{
+			__m128i const a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(memory + i +  0)), pattern);
+			__m128i const b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(memory + i + 16)), pattern);
+			__m128i const c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(memory + i + 32)), pattern);
+			__m128i const d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(memory + i + 48)), pattern);
+			if (_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d))) != 0xffff)
+				break;
+		}
+
+		// The scalar loop pins down the exact index in the mismatching chunk and handles the tail
+		return i + FindMismatchScalar(memory + i, size - i, value);
+	}
+
+	__attribute__((target("avx2")))
+	int64_t FindMismatchAvx2(char const * const memory, int64_t const size, char const value)
+	{
+		__m256i const pattern = _mm256_set1_epi8(value);
+		int64_t i = 0;
+		for (; i + 64 <= size; i += 64)
+		{
+			__m256i const a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(memory + i +  0)), pattern);
+			__m256i const b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(memory + i + 32)), pattern);
+			if (_mm256_movemask_epi8(_mm256_and_si256(a, b)) != -1)
+				break;
+		}
+
+		return i + FindMismatchScalar(memory + i, size - i, value);
+	}
+
+	__attribute__((target("avx512bw")))
+	int64_t FindMismatchAvx512(char const * const memory, int64_t const size, char const value)
+	{
+		__m512i const pattern = _mm512_set1_epi8(value);
+		int64_t i = 0;
+		for (; i + 64 <= size; i += 64)
+			if (_mm512_cmpneq_epi8_mask(_mm512_loadu_si512(memory + i), pattern))
+				break;
+
+		return i + FindMismatchScalar(memory + i, size - i, value);
+	}
+
+	FindMismatchFunction SelectFindMismatch()
+	{
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512bw"))
+			return FindMismatchAvx512;
+		if (__builtin_cpu_supports("avx2"))
+			return FindMismatchAvx2;
+		return FindMismatchSse2;
+	}
+
+	int64_t FindMismatch(void const * const memory, int64_t const size, char const value)
+	{
+		// Picked on first use, since frees can happen during other translation units' static initialization
+		static FindMismatchFunction const function = SelectFindMismatch();
+		return function(static_cast<char const *>(memory), size, value);
+	}
+
+	void Fill(void * const memory, char const value, int64_t const size, int64_t const non_temporal_size = NonTemporalFillSize)
+	{
+		if (size < non_temporal_size)
+		{
+			memset(memory, value, size);
+			return;
+		}
+
+		// Regular stores up to the first 16 byte boundary
+		char * bytes = static_cast<char *>(memory);
+		int const head = Padding(static_cast<int>(reinterpret_cast<intptr_t>(bytes)), 16);
+		memset(bytes, value, head);
+
+		// Stream the aligned body straight to memory
+		__m128i const pattern = _mm_set1_epi8(value);
+		int64_t i = head;
+		for (; i + 64 <= size; i += 64)
+		{
+			_mm_stream_si128(reinterpret_cast<__m128i *>(bytes + i +  0), pattern);
+			_mm_stream_si128(reinterpret_cast<__m128i *>(bytes + i + 16), pattern);
+			_mm_stream_si128(reinterpret_cast<__m128i *>(bytes + i + 32), pattern);
+			_mm_stream_si128(reinterpret_cast<__m128i *>(bytes + i + 48), pattern);
+		}
+
+		// Streaming stores are weakly ordered, fence them before the memory is handed out
+		_mm_sfence();
+		memset(bytes + i, value, size - i);
+	}
+
+	// Bitmaps of 64 bit words
+	void SetBits(uint64_t * const bits, int64_t const first, int64_t const count)
+	{
+		for (int64_t i = first, end = first + count; i < end; )
+		{
+			int const shift = static_cast<int>(i & 63);
+			int64_t const span = (64 - shift < end - i) ? 64 - shift : end - i;
+			bits[i >> 6] |= ((span == 64) ? ~uint64_t(0) : ((uint64_t(1) << span) - 1)) << shift;
+			i += span;
+		}
+	}
+
+	void ClearBits(uint64_t * const bits, int64_t const first, int64_t const count)
+	{
+		for (int64_t i = first, end = first + count; i < end; )
+		{
+			int const shift = static_cast<int>(i & 63);
+			int64_t const span = (64 - shift < end - i) ? 64 - shift : end - i;
+			bits[i >> 6] &= ~(((span == 64) ? ~uint64_t(0) : ((uint64_t(1) << span) - 1)) << shift);
+			i += span;
+		}
+	}
+
+	// Index of the first bit at or after first that is set (or clear), or end if there isn't one
+	int64_t FindBit(uint64_t const * const bits, int64_t const first, int64_t const end, bool const set)
+	{
+		for (int64_t i = first; i < end; )
+		{
+			uint64_t const word = (set ? bits[i >> 6] : ~bits[i >> 6]) >> (i & 63);
+			if (word)
+			{
+				int64_t const found = i + __builtin_ctzll(word);
+				return (found < end) ? found : end;
+			}
+			i = (i | 63) + 1;
+		}
+		return end;
+	}
+
+	uint64_t HashPointer(void const * const pointer)
+	{
+		uint64_t const value = reinterpret_cast<uintptr_t>(pointer);
+		return (value ^ (value >> 29)) * 0xbf58476d1ce4e5b9ull;
+	}
+
+	// Draw the distance to the next sample from an exponential distribution, which
+	// makes sampling a Poisson process over the allocated bytes as pprof expects
+	int64_t NextSampleInterval(uint64_t & state, int64_t const mean)
+	{
+		// xorshift64*
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		uint64_t const bits = (state * 0x2545f4914f6cdd1dull) >> 11;
+
+		// uniform in (0, 1]
+		double const uniform = (static_cast<double>(bits) + 1.0) * (1.0 / 9007199254740992.0);
+		return static_cast<int64_t>(-log(uniform) * static_cast<double>(mean)) + 1;
+	}
+
+	int64_t NextUniformInterval(uint64_t & state, int64_t const mean)
+	{
+		// xorshift64*, uniform in [1, 2 * mean - 1]
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return static_cast<int64_t>((state * 0x2545f4914f6cdd1dull) % (2 * static_cast<uint64_t>(mean) - 1)) + 1;
+	}
+
+	// Buffered writes to a file descriptor that never allocate from the heap
+	class OutputBuffer
+	{
+	public:
+
+		explicit OutputBuffer(int const fd) : fd(fd) {}
+		~OutputBuffer() { flush(); }
+
+		void print(char const * format, ...) __attribute__((format(printf, 2, 3)))
+		{
+			if (used > BufferSize - LineSize)
+				flush();
+			va_list args;
+			va_start(args, format);
+			int const length = vsnprintf(buffer + used, BufferSize - used, format, args);
+			va_end(args);
+			if (length > 0)
+				used += (length < BufferSize - used) ? length : BufferSize - used - 1;
+		}
+
+		void append(void const * const data, int64_t const size)
+		{
+			if (used + size > BufferSize)
+				flush();
+			if (size >= BufferSize)
+			{
+				writeAll(data, size);
+				return;
+			}
+			memcpy(buffer + used, data, size);
+			used += size;
+		}
+
+		void flush()
+		{
+			writeAll(buffer, used);
+			used = 0;
+		}
+
+	private:
+
+		void writeAll(void const * const data, int64_t const size)
+		{
+			char const * bytes = static_cast<char const *>(data);
+			for (int64_t remaining = size; remaining > 0; )
+			{
+				ssize_t const written = write(fd, bytes, remaining);
+				if (written <= 0)
+					return;
+				bytes += written;
+				remaining -= written;
+			}
+		}
+
+		static constexpr int BufferSize = 64 * 1024;
+		static constexpr int LineSize = 1024;
+
+		int const fd;
+		int used = 0;
+		char buffer[BufferSize];
+	};
+
+	// What a page of system memory holds for the heap that owns it
+	enum class PageTier : uintptr_t
+	{
+		None,
+		Blocks,
+		Guarded
+	};
+
+	// Process wide three level radix map from each 4kb page to what owns it, so frees can be routed and foreign pointers
+	// rejected without reading the memory.  Entries are the owning SystemAllocation or GuardedPool with the tier in its low bits.
+	class PageMap
+	{
+	public:
+
+		static void set(intptr_t const start, intptr_t const end, void const * const owner, PageTier const tier)
+		{
+			uintptr_t const entry = owner ? reinterpret_cast<uintptr_t>(owner) | static_cast<uintptr_t>(tier) : 0;
+			for (uintptr_t page = static_cast<uintptr_t>(start) >> PageBits; page < (static_cast<uintptr_t>(end) + PageMask) >> PageBits; ++page)
+			{
+				Node * const middle = node(root + (page >> (2 * LevelBits)));
+				Node * const leaf = node(middle->entries + ((page >> LevelBits) & LevelMask));
+				leaf->entries[page & LevelMask].store(entry, std::memory_order_release);
+			}
+		}
+
+		static uintptr_t get(void const * const memory)
+		{
+			uintptr_t const page = reinterpret_cast<uintptr_t>(memory) >> PageBits;
+			if (page >> (3 * LevelBits))
+				return 0;
+			Node const * const middle = reinterpret_cast<Node const *>(root[page >> (2 * LevelBits)].load(std::memory_order_acquire));
+			if (!middle)
+				return 0;
+			Node const * const leaf = reinterpret_cast<Node const *>(middle->entries[(page >> LevelBits) & LevelMask].load(std::memory_order_acquire));
+			if (!leaf)
+				return 0;
+			return leaf->entries[page & LevelMask].load(std::memory_order_acquire);
+		}
+
+		static void * owner(uintptr_t const entry)
+		{
+			return reinterpret_cast<void *>(entry & ~TierMask);
+		}
+
+		static PageTier tier(uintptr_t const entry)
+		{
+			return static_cast<PageTier>(entry & TierMask);
+		}
+
+	private:
+
+		static constexpr int PageBits = 12;
+		static constexpr uintptr_t PageMask = (uintptr_t(1) << PageBits) - 1;
+		static constexpr int LevelBits = 12;
+		static constexpr uintptr_t LevelMask = (uintptr_t(1) << LevelBits) - 1;
+		static constexpr uintptr_t TierMask = 7;
+
+		struct Node
+		{
+			std::atomic<uintptr_t> entries[uintptr_t(1) << LevelBits];
+		};
+
+		// Interior nodes are mapped directly so the map never calls back into a heap
+		static Node * node(std::atomic<uintptr_t> * const slot)
+		{
+			uintptr_t existing = slot->load(std::memory_order_acquire);
+			if (existing)
+				return reinterpret_cast<Node *>(existing);
+
+			void * const memory = mmap(nullptr, sizeof(Node), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (slot->compare_exchange_strong(existing, reinterpret_cast<uintptr_t>(memory), std::memory_order_acq_rel))
+				return static_cast<Node *>(memory);
+
+			// Another thread got there first
+			munmap(memory, sizeof(Node));
+			return reinterpret_cast<Node *>(existing);
+		}
+
+		static inline std::atomic<uintptr_t> root[uintptr_t(1) << LevelBits] = {};
+	};
+
+	// Holds the heap lock for a scope, when there is one
+	class HeapLock
+	{
+	public:
+
+		explicit HeapLock(std::recursive_mutex * const heap_mutex)
+		:
+			mutex(heap_mutex)
+		{
+			if (mutex)
+				mutex->lock();
+		}
+
+		~HeapLock()
+		{
+			if (mutex)
+				mutex->unlock();
+		}
+
+		HeapLock(HeapLock const &) = delete;
+		HeapLock & operator=(HeapLock const &) = delete;
+
+	private:
+
+		std::recursive_mutex * const mutex;
+	};
 }
 
+// The heap is only locked while a maintenance thread shares it
+#if USE_MAINTENANCE
+#define HEAP_LOCK() HeapLock const heap_lock(maintenance ? &maintenance->mutex : nullptr)
+#else
+#define HEAP_LOCK()
+#endif
+
 // ======================================================================
 
 struct ThreeHeap::SystemAllocation
 {
+	ThreeHeap * heap = nullptr;
 	SentinelBlock * start = nullptr;
 	SentinelBlock * end = nullptr;
 	SystemAllocation * next = nullptr;
 	SentinelBlock * first_sentinel = nullptr;
 	SentinelBlock * last_sentinel = nullptr;
+
+	// one bit per Alignment bytes from the start of the system allocation, set for free memory still waiting for its free fill
+	uint64_t * unfilled = nullptr;
+
+	int64_t granule(intptr_t const address) const
+	{
+		return (address - reinterpret_cast<intptr_t>(this)) / Alignment;
+	}
+
+	intptr_t address(int64_t const granule) const
+	{
+		return reinterpret_cast<intptr_t>(this) + granule * Alignment;
+	}
 };
 
 struct ThreeHeap::Block
 {
 	static constexpr uint32_t Marker = ('3' << 24) | ('H' << 16) | ('P' << 8) | ('B' << 0);
 	/* 4 */ uint32_t marker = Marker;
-	/* 2 */ BlockStatus status = BlockStatus::Unknown;
-	/* 2 */ int16_t fixed = 0;
+	/* 1 */ BlockStatus status = BlockStatus::Unknown;
+	/* 1 */ int8_t idle = 0; // free block the maintenance thread has already seen free on an earlier purge lap
+	/* 1 */ int8_t fixed = 0;
+	/* 1 */ BlockContents contents = BlockContents::Unknown;
 	/* 8 */ int64_t size = 0;
 
 	// doubly linked list in memory order for block coalescing
@@ -190,93 +651,518 @@ struct ThreeHeap::AllocatedBlock : public ThreeHeap::Block
 {
 	/* 8 */ int64_t allocation_size = 0;
 	/* 8 */ void * owner = nullptr;
-	/* 4 */ int alignment = 0;
+	/* 4 */ int handle = 0; // handle table entry + 1 for relocatable allocations, 0 if the block never moves
 	/* 4 */ Flags flags = zero;
+	/* 8 */ uint64_t timestamp = 0;
+
+	int guardBandSize() const
+	{
+		return flags.useGuardBands() ? GuardBandSize : 0;
+	}
+
+	void * memory() const
+	{
+		return reinterpret_cast<void *>(reinterpret_cast<intptr_t>(this) + HeaderSize + guardBandSize());
+	}
 };
 
 struct ThreeHeap::SentinelBlock : public ThreeHeap::Block
 {
 };
 
-// ======================================================================
-
-void ThreeHeap::DefaultInterface::tree_fixed_nodes(int64_t * & sizes, int & count)
+struct ThreeHeap::Profiler
 {
-	sizes = nullptr;
-	count = 0;
-}
+	static constexpr int MaximumStackDepth = 32;
+	static constexpr int StackCapacity = 4 * 1024;
+	static constexpr int SampleCapacity = 16 * 1024;
+	static_assert((StackCapacity & (StackCapacity-1)) == 0);
+	static_assert((SampleCapacity & (SampleCapacity-1)) == 0);
+
+	// unique call stack, with the sampled allocations attributed to it
+	struct Stack
+	{
+		uint64_t hash = 0;
+		int depth = 0;
+		int64_t live_count = 0;
+		int64_t live_bytes = 0;
+		int64_t total_count = 0;
+		int64_t total_bytes = 0;
+		void * frames[MaximumStackDepth] = {};
+	};
 
-void * ThreeHeap::DefaultInterface::system_allocator(int64_t & size)
+	// sampled allocation that has not been freed yet
+	struct Sample
+	{
+		void const * memory = nullptr;
+		int64_t size = 0;
+		int stack = 0;
+	};
+
+	int64_t sample_interval = 0;
+	uint64_t random = 0x9e3779b97f4a7c15ull;
+	int number_of_stacks = 0;
+	int number_of_samples = 0;
+	int64_t dropped_samples = 0;
+
+	// open addressed tables, stacks keyed by the hash of the frames and samples by address
+	Stack stacks[StackCapacity];
+	Sample samples[SampleCapacity];
+};
+
+struct ThreeHeap::Quarantine
 {
-	if (size == 0)
-		size = 1;
+	static constexpr int Capacity = 64 * 1024;
 
-	// Allocate 16mb blocks from the underlying system
-	const int64_t system_allocation_size = 16 * 1024 * 1024;
-	size = size + system_allocation_size - 1;
-	size = size - (size % system_allocation_size);
+	int64_t budget = 0;
+	int64_t bytes = 0;
 
-	void * result = sbrk(size);
-	return result;
-}
+	// FIFO ring of quarantined blocks
+	int first = 0;
+	int count = 0;
+	AllocatedBlock * blocks[Capacity] = {};
+};
 
-void ThreeHeap::DefaultInterface::report_operation(void const * const memory, int64_t const size, int const alignment, void const * const owner, Flags const flags)
+struct ThreeHeap::GuardedPool
 {
-	if (flags.isAllocate())
+	static constexpr int NumberOfSlots = 256;
+	static constexpr int64_t PageSize = 4096;
+	static constexpr int SlotAlignment = 16;
+
+	// a slot is one page for the allocation followed by a guard page, with one more guard page in front of the first slot
+	struct Slot
 	{
-		printf("op=alloc result=%p size=%d align=%d owner=%p flags=%x\n", memory, (int)size, alignment, owner, flags.flags);
-	}
-	else
+		void * memory = nullptr;
+		int64_t size = 0;
+		void const * owner = nullptr;
+		Flags flags = zero;
+		bool allocated = false;
+	};
+
+	ThreeHeap * heap = nullptr;
+	GuardedPool * next = nullptr;
+	intptr_t start = 0;
+	intptr_t end = 0;
+	int sample_rate = 0;
+	int next_slot = 0;
+	uint64_t random = 0x2545f4914f6cdd1dull;
+	Slot slots[NumberOfSlots];
+
+	bool contains(void const * const memory) const
 	{
-		printf("op=free memory=%p size=%d owner=%p flags=%x\n", memory, (int)size, owner, flags.flags);
+		intptr_t const address = reinterpret_cast<intptr_t>(memory);
+		return address >= start && address < end;
 	}
-}
 
-void ThreeHeap::DefaultInterface::report_allocations(void const * const memory, int64_t const size, void const * const owner, Flags const flags)
-{
-	printf("allocation memory=%p size=%d owner=%p flags=%x\n", memory, (int)size, owner, flags.flags);
-}
+	intptr_t page(int const slot) const
+	{
+		return start + (2 * slot + 1) * PageSize;
+	}
 
-void ThreeHeap::DefaultInterface::error(ErrorInfo const & error)
-{
-	printf("ERROR!\n");
-	switch (error.type)
+	Slot & slot(void const * const memory)
 	{
-		case ErrorInfo::Type::Assert:
-			printf("  %s:%d\n", error.file, error.line);
-			printf("  assert failed: %s\n", error.assert);
-			break;
+		return slots[(reinterpret_cast<intptr_t>(memory) - start) / PageSize / 2];
+	}
 
-		case ErrorInfo::Type::MismatchedFree:
-			printf("  mismatched allocation/free %p %d\n", error.memory, (int)error.size);
-			printf("  alloc was %s, but free is %s\n", GetAllocFlags(error.allocation_flags), GetFreeFlags(error.free_flags));
-			break;
+	// Guarded pools of every heap, for the fault handler
+	static inline GuardedPool * pools = nullptr;
+	static inline struct sigaction previous_action = {};
 
-		case ErrorInfo::Type::GuardBandCorruption:
-			printf("  guard band corruption %p %d\n", error.memory, (int)error.size);
-			printf("  prefix byte map:\n    ");
-			for (int i = 0; i < error.pre_size; ++i)
-				putchar(error.pre_guard_band_corrupt[i] ? 'X' : '.');
-			printf("<alloc>\n  postfix byte map:\n    ");
-			for (int i = 0; i < error.post_size; ++i)
-				putchar(error.post_guard_band_corrupt[i] ? 'X' : '.');
-			printf("<alloc>\n");
-			break;
+	static void faultHandler(int const number, siginfo_t * const info, void * const context)
+	{
+		for (GuardedPool * pool = pools; pool; pool = pool->next)
+			if (pool->contains(info->si_addr))
+			{
+				pool->reportFault(info->si_addr);
 
-		case ErrorInfo::Type::FreeCorruption:
-			printf("  free memory corruption %p %d\n", error.memory, (int)error.size);
-			printf("  at byte %d\n", error.free_corrupt_index);
-			break;
+				// If the error handler returns, let the access fault again without the handler
+				signal(SIGSEGV, SIG_DFL);
+				return;
+			}
 
-		default:
-			printf("  unknown error %d\n", static_cast<int>(error.type));
-			break;
-	};
+		// Not ours, hand it to whoever was installed before us
+		if (previous_action.sa_flags & SA_SIGINFO)
+			previous_action.sa_sigaction(number, info, context);
+		else if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN)
+			previous_action.sa_handler(number);
+		else
+			signal(SIGSEGV, SIG_DFL);
+	}
 
-	terminate();
-}
+	// Unmaps the pool, and puts the previous fault handler back once no heap has a pool
+	void release()
+	{
+		GuardedPool ** link = &pools;
+		while (*link != this)
+			link = &(*link)->next;
+		*link = next;
+
+		munmap(reinterpret_cast<void *>(start), end - start);
+		if (!pools)
+			sigaction(SIGSEGV, &previous_action, nullptr);
+	}
 
-void ThreeHeap::DefaultInterface::terminate()
+	void reportFault(void const * const address)
+	{
+		// Data pages are only accessible while allocated, so a fault on one is a use after free.
+		// Allocations are right aligned, so a fault on a guard page belongs to the slot before it,
+		// except the leading guard page which has no slot before it and can only be reached by running off the front of slot 0
+		intptr_t const offset = reinterpret_cast<intptr_t>(address) - start;
+		bool const leading_guard_page = offset < PageSize;
+		bool const guard_page = ((offset / PageSize) & 1) == 0;
+		int const index = leading_guard_page ? 0 : static_cast<int>((offset / PageSize - 1) / 2);
+
+		Slot const & faulted = slots[index];
+		ErrorInfo info;
+		info.type = leading_guard_page ? ErrorInfo::Type::BufferUnderflow : guard_page ? ErrorInfo::Type::BufferOverflow : ErrorInfo::Type::UseAfterFree;
+		info.memory = faulted.memory;
+		info.size = faulted.size;
+		info.owner = faulted.owner;
+		info.allocation_flags = faulted.flags;
+		info.fault_address = address;
+		heap->external.error(info);
+	}
+};
+
+struct ThreeHeap::OwnerTable
+{
+	static constexpr int Capacity = 16 * 1024;
+	static_assert((Capacity & (Capacity-1)) == 0);
+
+	// open addressed by owner, entries are never removed so there are no tombstones
+	int number_of_owners = 0;
+	OwnerStatistics unowned;
+	OwnerStatistics owners[Capacity];
+
+	// parallel to owners with the unowned entry last, only present when tracking lifetimes
+	LifetimeStatistics * lifetimes = nullptr;
+
+	LifetimeStatistics & lifetime(OwnerStatistics const & entry)
+	{
+		return lifetimes[(&entry == &unowned) ? Capacity : (&entry - owners)];
+	}
+};
+
+// Free blocks up to MaximumSize are kept in exact size lists instead of the tree, found through a bitmap of
+// the sizes with free blocks and a summary bitmap of its words.  A best fit search only reads a few dense cache
+// lines of bitmap before touching the chosen block.  The lists are linked through the blocks' equal and parent.
+struct ThreeHeap::SizeIndex
+{
+	static constexpr int64_t MaximumSize = 1024 * 1024;
+	static constexpr int NumberOfSizes = MaximumSize / Alignment;
+	static constexpr int NumberOfWords = NumberOfSizes / 64;
+	static constexpr int NumberOfSummaryWords = NumberOfWords / 64;
+	static_assert(NumberOfSummaryWords * 64 * 64 == NumberOfSizes);
+
+	uint64_t summary[NumberOfSummaryWords] = {};
+	uint64_t occupied[NumberOfWords] = {};
+	FreeBlock * heads[NumberOfSizes] = {};
+
+	static bool holds(FreeBlock const * const block)
+	{
+		return !block->fixed && block->size <= MaximumSize;
+	}
+
+	static int index(int64_t const size)
+	{
+		return static_cast<int>((size + Alignment - 1) / Alignment) - 1;
+	}
+
+	void add(FreeBlock * const block, bool const address_ordered)
+	{
+		int const i = index(block->size);
+
+		// Address ordered lists insert after the lower addressed blocks, otherwise the newest is first
+		FreeBlock * previous = nullptr;
+		FreeBlock * next = heads[i];
+		if (address_ordered)
+			while (next && next < block)
+			{
+				previous = next;
+				next = next->equal;
+			}
+
+		block->parent = previous;
+		block->equal = next;
+		if (previous)
+			previous->equal = block;
+		else
+			heads[i] = block;
+		if (next)
+			next->parent = block;
+
+		occupied[i >> 6] |= uint64_t(1) << (i & 63);
+		summary[i >> 12] |= uint64_t(1) << ((i >> 6) & 63);
+	}
+
+	void remove(FreeBlock * const block)
+	{
+		int const i = index(block->size);
+		FreeBlock * const previous = block->parent;
+		FreeBlock * const next = block->equal;
+		if (previous)
+			previous->equal = next;
+		else
+			heads[i] = next;
+		if (next)
+			next->parent = previous;
+		block->parent = nullptr;
+		block->equal = nullptr;
+
+		if (!heads[i])
+		{
+			occupied[i >> 6] &= ~(uint64_t(1) << (i & 63));
+			if (!occupied[i >> 6])
+				summary[i >> 12] &= ~(uint64_t(1) << ((i >> 6) & 63));
+		}
+	}
+
+	// The first block of the smallest indexed size that fits, nullptr if only the tree can have one
+	FreeBlock * search(int64_t const size) const
+	{
+		int const i = index(size);
+		if (i >= NumberOfSizes)
+			return nullptr;
+
+		int word = i >> 6;
+		uint64_t bits = occupied[word] & (~uint64_t(0) << (i & 63));
+		if (!bits)
+		{
+			// Find the next word with any sizes from the summary
+			int const next = word + 1;
+			int summary_word = next >> 6;
+			if (summary_word >= NumberOfSummaryWords)
+				return nullptr;
+			uint64_t summary_bits = summary[summary_word] & (~uint64_t(0) << (next & 63));
+			while (!summary_bits && ++summary_word < NumberOfSummaryWords)
+				summary_bits = summary[summary_word];
+			if (!summary_bits)
+				return nullptr;
+
+			word = (summary_word << 6) + __builtin_ctzll(summary_bits);
+			bits = occupied[word];
+		}
+
+		return heads[(word << 6) + __builtin_ctzll(bits)];
+	}
+};
+
+// Master pointers for relocatable allocations, a Handle points at an entry's memory
+struct ThreeHeap::HandleTable
+{
+	static constexpr int Capacity = 64 * 1024;
+
+	struct Entry
+	{
+		void * memory = nullptr;
+		int lock_count = 0;
+		int next_free = -1;
+		Flags flags = zero;
+	};
+
+	int first_free = -1;
+	int number_used = 0;
+	Entry entries[Capacity];
+
+	static Entry & entry(Handle const handle)
+	{
+		return *reinterpret_cast<Entry *>(const_cast<void **>(handle));
+	}
+};
+
+// Background thread doing bounded chunks of heap upkeep, the mutex outlives the thread so the heap can be locked after it stops
+struct ThreeHeap::Maintenance
+{
+	// Deferred free fill bytes done per tick
+	static constexpr int64_t FillBudget = 1024 * 1024;
+
+	// Smallest free block a tick purges
+	static constexpr int64_t PurgeMinimumSize = 64 * 1024;
+
+	// Shortest time between the starts of purge laps, so a block is only purged after being free for about this long
+	static constexpr std::chrono::milliseconds PurgeInterval{1000};
+
+	std::recursive_mutex mutex;
+
+	std::thread thread;
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	bool stop = false;
+
+	int milliseconds = 0;
+	Flags verify_flags = zero;
+
+	// The system allocation the next tick works on
+	SystemAllocation * cursor = nullptr;
+
+	// Whether the current lap purges, and when the last purge lap started
+	bool purge_lap = false;
+	std::chrono::steady_clock::time_point purge_lap_start;
+};
+
+// Worker threads for verifyParallel().  They are kept between calls, since starting and stopping a thread allocates and
+// frees memory, which might come from the very heap the workers are reading
+struct ThreeHeap::VerifyPool
+{
+	static constexpr int MaximumThreads = 64;
+
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable done;
+
+	std::thread threads[MaximumThreads];
+	int number_of_threads = 0;
+
+	// Bumped to start a pass, the workers count themselves out of busy when their part is done
+	uint64_t generation = 0;
+	int busy = 0;
+	bool stop = false;
+
+	Flags flags = zero;
+	std::atomic<SystemAllocation const *> next_allocation{nullptr};
+	std::atomic<int> free_blocks{0};
+
+	// Claim the next unchecked system allocation
+	SystemAllocation const * take()
+	{
+		SystemAllocation const * allocation = next_allocation.load();
+		while (allocation && !next_allocation.compare_exchange_weak(allocation, allocation->next))
+			;
+		return allocation;
+	}
+};
+
+// ======================================================================
+
+void ThreeHeap::DefaultInterface::tree_fixed_nodes(int64_t * & sizes, int & count)
+{
+	sizes = nullptr;
+	count = 0;
+}
+
+void * ThreeHeap::DefaultInterface::system_allocator(int64_t & size)
+{
+	if (size == 0)
+		size = 1;
+
+	// Allocate 16mb blocks from the underlying system
+	const int64_t system_allocation_size = 16 * 1024 * 1024;
+	size = size + system_allocation_size - 1;
+	size = size - (size % system_allocation_size);
+
+	void * result = sbrk(size);
+	return result;
+}
+
+void * ThreeHeap::ExternalInterface::system_allocator_aligned(int64_t & size, int64_t const alignment)
+{
+	// Over allocate and skip up to the alignment, whatever is left over is still usable and at least the size asked for
+	int64_t padded_size = size + alignment;
+	intptr_t const memory = reinterpret_cast<intptr_t>(system_allocator(padded_size));
+	intptr_t const aligned = (memory + alignment - 1) & ~(alignment - 1);
+	size = padded_size - (aligned - memory);
+	return reinterpret_cast<void *>(aligned);
+}
+
+void * ThreeHeap::DefaultInterface::system_allocator_aligned(int64_t & size, int64_t const alignment)
+{
+	// The break only has to be aligned once, the 16mb multiples after it keep it aligned
+	intptr_t const current = reinterpret_cast<intptr_t>(sbrk(0));
+	intptr_t const padding = ((current + alignment - 1) & ~(alignment - 1)) - current;
+	if (padding)
+		sbrk(padding);
+	return system_allocator(size);
+}
+
+bool ThreeHeap::DefaultInterface::system_memory_zeroed()
+{
+	// sbrk memory is private anonymous memory
+	return true;
+}
+
+void ThreeHeap::DefaultInterface::report_operation(void const * const memory, int64_t const size, int const alignment, void const * const owner, Flags const flags)
+{
+	if (flags.isAllocate())
+	{
+		printf("op=alloc result=%p size=%d align=%d owner=%p flags=%x\n", memory, (int)size, alignment, owner, flags.flags);
+	}
+	else
+	{
+		printf("op=free memory=%p size=%d owner=%p flags=%x\n", memory, (int)size, owner, flags.flags);
+	}
+}
+
+void ThreeHeap::DefaultInterface::report_allocations(void const * const memory, int64_t const size, void const * const owner, Flags const flags)
+{
+	printf("%s memory=%p size=%d owner=%p flags=%x\n", flags.isArena() ? "arena block" : flags.isPool() ? "pool slab" : "allocation", memory, (int)size, owner, flags.flags);
+}
+
+void ThreeHeap::DefaultInterface::error(ErrorInfo const & error)
+{
+	printf("ERROR!\n");
+	switch (error.type)
+	{
+		case ErrorInfo::Type::Assert:
+			printf("  %s:%d\n", error.file, error.line);
+			printf("  assert failed: %s\n", error.assert);
+			break;
+
+		case ErrorInfo::Type::MismatchedFree:
+			printf("  mismatched allocation/free %p %d\n", error.memory, (int)error.size);
+			printf("  alloc was %s, but free is %s\n", GetAllocFlags(error.allocation_flags), GetFreeFlags(error.free_flags));
+			break;
+
+		case ErrorInfo::Type::GuardBandCorruption:
+			printf("  guard band corruption %p %d\n", error.memory, (int)error.size);
+			printf("  prefix byte map:\n    ");
+			for (int i = 0; i < error.pre_size; ++i)
+				putchar(error.pre_guard_band_corrupt[i] ? 'X' : '.');
+			printf("<alloc>\n  postfix byte map:\n    ");
+			for (int i = 0; i < error.post_size; ++i)
+				putchar(error.post_guard_band_corrupt[i] ? 'X' : '.');
+			printf("<alloc>\n");
+			break;
+
+		case ErrorInfo::Type::FreeCorruption:
+			printf("  free memory corruption %p %d\n", error.memory, (int)error.size);
+			printf("  at byte %d\n", error.free_corrupt_index);
+			if (error.owner)
+				printf("  freed allocation was owned by %p\n", error.owner);
+			break;
+
+		case ErrorInfo::Type::UseAfterFree:
+			printf("  use after free %p %d\n", error.memory, (int)error.size);
+			printf("  accessed %p, allocation was owned by %p\n", error.fault_address, error.owner);
+			break;
+
+		case ErrorInfo::Type::BufferOverflow:
+			printf("  buffer overflow %p %d\n", error.memory, (int)error.size);
+			printf("  accessed %p, allocation is owned by %p\n", error.fault_address, error.owner);
+			break;
+
+		case ErrorInfo::Type::BufferUnderflow:
+			printf("  buffer underflow %p %d\n", error.memory, (int)error.size);
+			printf("  accessed %p, allocation is owned by %p\n", error.fault_address, error.owner);
+			break;
+
+		case ErrorInfo::Type::DoubleFree:
+			printf("  double free %p %d\n", error.memory, (int)error.size);
+			printf("  allocation was owned by %p\n", error.owner);
+			break;
+
+		case ErrorInfo::Type::InvalidFree:
+			printf("  invalid free %p\n", error.memory);
+			printf("  memory was not allocated from this heap, free is %s\n", GetFreeFlags(error.free_flags));
+			break;
+
+		default:
+			printf("  unknown error %d\n", static_cast<int>(error.type));
+			break;
+	};
+
+	terminate();
+}
+
+void ThreeHeap::DefaultInterface::terminate()
 {
 	abort();
 }
@@ -286,34 +1172,83 @@ void ThreeHeap::DefaultInterface::terminate()
 ThreeHeap::ThreeHeap(ExternalInterface& external_interface, Flags const flags)
 :
 	external(external_interface),
-	heap_flags(flags),
-	guard_band_size(flags.useGuardBands() ? GuardBandSize : 0)
+	heap_flags(flags)
 {
 	static_assert(sizeof(ThreeHeap::Block) <= HeaderSize);
 	static_assert(sizeof(ThreeHeap::FreeBlock) <= HeaderSize);
 	static_assert(sizeof(ThreeHeap::AllocatedBlock) <= HeaderSize);
+	static_assert(sizeof(ThreeHeap::SystemAllocation) <= HeaderSize);
 
 	// fixed nodes will sometimes fail allocation, disable for now
 	// external_interface.tree_fixed_nodes(fixed_node_sizes, fixed_nodes_count);
 
+#if USE_SIZE_INDEX
+	if (flags.useSizeIndex())
+		free_size_index = new(allocateMetadata(sizeof(SizeIndex))) SizeIndex();
+#endif
+
 	if (fixed_nodes_count)
 		allocateFromSystem(fixed_nodes_count * HeaderSize);
+
+#if USE_OWNER_STATISTICS
+	if (flags.trackOwners())
+		owner_table = new(allocateMetadata(sizeof(OwnerTable))) OwnerTable();
+
+#if USE_LIFETIME_STATISTICS
+	if (owner_table && flags.trackLifetimes())
+		owner_table->lifetimes = new(allocateMetadata(sizeof(LifetimeStatistics) * (OwnerTable::Capacity + 1))) LifetimeStatistics[OwnerTable::Capacity + 1]();
+#endif
+#endif
 }
 
 void ThreeHeap::allocateFromSystem(int64_t const minimum_size)
 {
+	// Lazy free fills need a bitmap with a bit per Alignment bytes after the system allocation object
+	auto const unfilled_size = [](int64_t const size)
+	{
+		int64_t const bytes = (size / Alignment + 7) / 8;
+		return bytes + Padding(static_cast<int>(bytes), Alignment);
+	};
+	bool const lazy = heap_flags.lazyFillFrees();
+
 	// Ask the system for memory, it may resize the allocation
 	// Add space in the allocation for the sentinel nodes
 	int64_t allocation_size = HeaderSize + HeaderSize + minimum_size + HeaderSize;
-	void * const memory = external.system_allocator(allocation_size);
+	if (lazy)
+		allocation_size += 2 * unfilled_size(allocation_size) + HeaderSize;
+	// Chunks are page aligned so no page of the page map is shared with another heap
+	int64_t const requested_size = allocation_size;
+	void * const memory = external.system_allocator_aligned(allocation_size, heap_flags.useHugePages() ? HugePageSize : SystemPageSize);
 	intptr_t m = reinterpret_cast<intptr_t>(memory);
 
+	// The interface may hand back any size over the request, only whole Alignment units of it make blocks
+	assert(allocation_size >= requested_size);
+	allocation_size &= ~static_cast<int64_t>(Alignment - 1);
+
+	// Only whole huge pages can be advised
+	if (heap_flags.useHugePages())
+	{
+		int64_t const advised = allocation_size & ~(HugePageSize - 1);
+		if (advised && madvise(memory, advised, MADV_HUGEPAGE) == 0)
+			huge_page_bytes_advised += advised;
+	}
+
 	bool const fixed = !first_system_allocation && fixed_nodes_count;
 
-	// Create the system allocation object
+	// Create the system allocation object, and map its pages to it so any address in it finds it directly
 	SystemAllocation * const allocation = new(reinterpret_cast<void *>(m)) SystemAllocation();
+	allocation->heap = this;
+	PageMap::set(m, m + allocation_size, allocation, PageTier::Blocks);
 	m += HeaderSize;
 
+	int64_t const bitmap_size = lazy ? unfilled_size(allocation_size) : 0;
+	if (lazy)
+	{
+		allocation->unfilled = reinterpret_cast<uint64_t *>(m);
+		memset(allocation->unfilled, 0, bitmap_size);
+		m += bitmap_size;
+	}
+
 	// sentinels to remove special cases from the code
 	SentinelBlock * const start_sentinel = new(reinterpret_cast<void *>(m)) SentinelBlock();
 	m += HeaderSize;
@@ -339,16 +1274,22 @@ void ThreeHeap::allocateFromSystem(int64_t const minimum_size)
 
 	// Create the free block from the heap
 	FreeBlock * const free_block = new(reinterpret_cast<void *>(m)) FreeBlock();
-	int64_t const free_size = allocation_size - ((3 + fixed_nodes_count) * HeaderSize);
+	int64_t const free_size = allocation_size - bitmap_size - ((3 + fixed_nodes_count) * HeaderSize);
 
 #if USE_FILL_FREES
-	if (heap_flags.fillFrees())
-		memset(reinterpret_cast<void*>(m + HeaderSize), FreeFillChar, free_size - HeaderSize);
+	if (lazy)
+		markUnfilled(allocation, m + HeaderSize, free_size - HeaderSize);
+	else if (heap_flags.fillFrees())
+		Fill(reinterpret_cast<void*>(m + HeaderSize), FreeFillChar, free_size - HeaderSize);
 #endif
 
 	m += free_size;
 	free_block->status = BlockStatus::Free;
 	free_block->size = free_size;
+	if (heap_flags.fillFrees())
+		free_block->contents = BlockContents::FreeFilled;
+	else if (external.system_memory_zeroed())
+		free_block->contents = BlockContents::Zero;
 	current_bytes_free += free_size;
 	free_block->previous = previous;
 	previous->next = free_block;
@@ -376,6 +1317,34 @@ void ThreeHeap::allocateFromSystem(int64_t const minimum_size)
 
 ThreeHeap::~ThreeHeap()
 {
+#if USE_MAINTENANCE
+	setMaintenanceInterval(0);
+#endif
+
+#if USE_PARALLEL_VERIFY
+	if (verify_pool)
+	{
+		{
+			std::lock_guard<std::mutex> const lock(verify_pool->mutex);
+			verify_pool->stop = true;
+		}
+		verify_pool->start.notify_all();
+		for (int i = 0; i < verify_pool->number_of_threads; ++i)
+			verify_pool->threads[i].join();
+	}
+#endif
+
+	// Forget the heap's pages so frees of its memory are reported rather than routed to a dead heap
+	for (SystemAllocation * allocation = first_system_allocation; allocation; allocation = allocation->next)
+		PageMap::set(reinterpret_cast<intptr_t>(allocation), reinterpret_cast<intptr_t>(allocation->end) + HeaderSize, nullptr, PageTier::None);
+
+#if USE_GUARDED_SAMPLING
+	if (guarded_pool)
+	{
+		PageMap::set(guarded_pool->start, guarded_pool->end, nullptr, PageTier::None);
+		guarded_pool->release();
+	}
+#endif
 }
 
 void ThreeHeap::addToFreeList(FreeBlock * const block)
@@ -387,16 +1356,25 @@ void ThreeHeap::addToFreeList(FreeBlock * const block)
 	assert(block->greater == nullptr);
 	assert(block->parent == nullptr);
 
+#if USE_SIZE_INDEX
+	if (free_size_index && SizeIndex::holds(block))
+	{
+		free_size_index->add(block, placement == PlacementPolicy::AddressOrderedBestFit);
+		return;
+	}
+#endif
+
 	// Handle inserting into an empty tree
 	FreeBlock * node = free_list;
 	if (!node)
 	{
 		free_list = block;
+		TREE_OPERATION(insert, 0);
 		return;
 	}
 
 	int64_t const block_size = block->size;
-	for (;;)
+	for (int nodes_visited = 1; ; ++nodes_visited)
 	{
 		if (block_size < node->size)
 		{
@@ -411,6 +1389,7 @@ void ThreeHeap::addToFreeList(FreeBlock * const block)
 			// Add the block as less child
 			node->less = block;
 			block->parent = node;
+			TREE_OPERATION(insert, nodes_visited);
 			return;
 		}
 
@@ -427,10 +1406,16 @@ void ThreeHeap::addToFreeList(FreeBlock * const block)
 			// Add the block as greater child
 			node->greater = block;
 			block->parent = node;
+			TREE_OPERATION(insert, nodes_visited);
 			return;
 		}
 
-		// Add the block as first equal child
+		// Add the block as first equal child, or after the lower addressed ones when they are kept in address order.
+		// That walk is linear in the number of free blocks of this size, so it is counted as part of the insert depth
+		// where a heap with many same sized free blocks shows up in the tree statistics
+		if (placement == PlacementPolicy::AddressOrderedBestFit)
+			for (; node->equal && node->equal < block; ++nodes_visited)
+				node = node->equal;
 		FreeBlock * const equal = node->equal;
 		node->equal = block;
 		block->parent = node;
@@ -439,6 +1424,7 @@ void ThreeHeap::addToFreeList(FreeBlock * const block)
 			block->equal = equal;
 			equal->parent = block;
 		}
+		TREE_OPERATION(insert, nodes_visited);
 		return;
 	}
 }
@@ -447,6 +1433,14 @@ void ThreeHeap::removeFromFreeList(FreeBlock * const block)
 {
 	assert(block->status == BlockStatus::Free);
 
+#if USE_SIZE_INDEX
+	if (free_size_index && SizeIndex::holds(block))
+	{
+		free_size_index->remove(block);
+		return;
+	}
+#endif
+
 	// We can more cases with less code by keeping track of the parent pointer to update with a second level of indirection
 	FreeBlock * const parent = block->parent;
 	FreeBlock * * pparent = nullptr;
@@ -462,6 +1456,7 @@ void ThreeHeap::removeFromFreeList(FreeBlock * const block)
 				block_equal->parent = parent;
 			parent->equal = block_equal;
 			block->equal = nullptr;
+			TREE_OPERATION(remove, 0);
 			return;
 		}
 
@@ -505,6 +1500,7 @@ void ThreeHeap::removeFromFreeList(FreeBlock * const block)
 			block_equal->greater = block_greater;
 			block_greater->parent = block_equal;
 		}
+		TREE_OPERATION(remove, 0);
 		return;
 	}
 
@@ -517,6 +1513,7 @@ void ThreeHeap::removeFromFreeList(FreeBlock * const block)
 			// Block only has the less child, use it as the replacement
 			block_less->parent = parent;
 			*pparent = block_less;
+			TREE_OPERATION(remove, 0);
 			return;
 		}
 		else
@@ -532,11 +1529,13 @@ void ThreeHeap::removeFromFreeList(FreeBlock * const block)
 			block->greater = nullptr;
 			block_greater->parent = parent;
 			*pparent = block_greater;
+			TREE_OPERATION(remove, 0);
 			return;
 		}
 
 		// Block is a leaf, nip it off the tree
 		*pparent = nullptr;
+		TREE_OPERATION(remove, 0);
 		return;
 	}
 
@@ -546,7 +1545,8 @@ void ThreeHeap::removeFromFreeList(FreeBlock * const block)
 	// the smaller child into the larger child, attached to the smallest
 	// element in the larger subtree.
 	FreeBlock * smallest_larger_block = block_greater;
-	for (;;)
+	int nodes_visited = 1;
+	for (;; ++nodes_visited)
 	{
 		FreeBlock * less = smallest_larger_block->less;
 		if (less)
@@ -554,6 +1554,7 @@ void ThreeHeap::removeFromFreeList(FreeBlock * const block)
 		else
 			break;
 	}
+	TREE_OPERATION(remove, nodes_visited);
 
 	// connect the current block's less child to the smallest larger free block on its less side
 	smallest_larger_block->less = block_less;
@@ -566,9 +1567,26 @@ void ThreeHeap::removeFromFreeList(FreeBlock * const block)
 
 ThreeHeap::FreeBlock * ThreeHeap::searchFreeList(const int64_t size)
 {
+	// The address ordered policies walk the blocks rather than the tree
+	if (placement == PlacementPolicy::FirstFit || placement == PlacementPolicy::NextFit)
+	{
+		if (!first_system_allocation)
+			return nullptr;
+		Block * const start = (placement == PlacementPolicy::NextFit && next_fit) ? next_fit : first_system_allocation->start->next;
+		return searchAddressOrder(size, start);
+	}
+
+#if USE_SIZE_INDEX
+	// Every indexed block is smaller than every block in the tree
+	if (free_size_index)
+		if (FreeBlock * const indexed = free_size_index->search(size))
+			return indexed;
+#endif
+
 	// iterative descent through the tree looking for the best fit
 	FreeBlock * best_fit = nullptr;
-	for (FreeBlock * block = free_list; block; )
+	int nodes_visited = 0;
+	for (FreeBlock * block = free_list; block; ++nodes_visited)
 	{
 		if (size < block->size)
 		{
@@ -587,8 +1605,10 @@ ThreeHeap::FreeBlock * ThreeHeap::searchFreeList(const int64_t size)
 
 		// return the right size block
 		best_fit = block;
+		++nodes_visited;
 		break;
 	}
+	TREE_OPERATION(search, nodes_visited);
 
 	// Bail if we couldn't find a node to fit
 	if (!best_fit)
@@ -597,61 +1617,235 @@ ThreeHeap::FreeBlock * ThreeHeap::searchFreeList(const int64_t size)
 	// If the best fitting node has an equally sized child, use that as it'll be faster to remove from the tree
 	FreeBlock * const equal = best_fit->equal;
 	if (equal)
+	{
+		// The equal chain is in address order after the node, so the lowest address is one of the first two
+		if (placement == PlacementPolicy::AddressOrderedBestFit && best_fit < equal)
+			return best_fit;
 		return equal;
+	}
 
 	return best_fit;
 }
 
-void * ThreeHeap::own(void * const memory, void * const owner)
+ThreeHeap::FreeBlock * ThreeHeap::searchAddressOrder(int64_t const size, Block * const start)
 {
-	intptr_t block_address = reinterpret_cast<intptr_t>(memory) - HeaderSize - guard_band_size;
-	AllocatedBlock * allocated_block = reinterpret_cast<AllocatedBlock *>(block_address);
-	assert(allocated_block->marker == Block::Marker);
-	assert(allocated_block->previous->next == allocated_block);
-	assert(allocated_block->next->previous == allocated_block);
-	assert(allocated_block->status == BlockStatus::Allocated);
-	allocated_block->owner = owner;
-	return memory;
+	// Walk every block from start in address order, wrapping around through the system allocations
+	SystemAllocation * allocation = findSystemAllocation(start);
+	Block * block = start;
+	int nodes_visited = 0;
+	FreeBlock * fit = nullptr;
+	do
+	{
+		if (block == allocation->end)
+		{
+			allocation = allocation->next ? allocation->next : first_system_allocation;
+			block = allocation->start->next;
+			continue;
+		}
+
+		++nodes_visited;
+		if (block->status == BlockStatus::Free && block != victim && !block->fixed && block->size >= size)
+		{
+			fit = static_cast<FreeBlock *>(block);
+			break;
+		}
+		block = block->next;
+	} while (block != start);
+	TREE_OPERATION(search, nodes_visited);
+
+	return fit;
 }
 
-void * ThreeHeap::allocate(int64_t const size, int const alignment, Flags const oflags, void * const owner)
+void ThreeHeap::setPlacementPolicy(PlacementPolicy const policy)
 {
-	Flags combined_flags = oflags | heap_flags;
+	HEAP_LOCK();
 
-	// calculate the total size of the allocation block
-	const int64_t padding = Padding(size, Alignment);
-	const int64_t additional_alignment = (alignment > Alignment) ? alignment : 0;
-	assert(additional_alignment == 0);
-	const int64_t block_size = HeaderSize + guard_band_size + size + padding + additional_alignment + guard_band_size; 
+	placement = policy;
+	next_fit = nullptr;
 
-	// Search for best node to use for this allocation
-	// @TODO handle `node` being nullptr here and allocate a new block from the system and retry
-	FreeBlock * free_block = searchFreeList(block_size);
-	if (!free_block)
-		free_block = searchFreeList(block_size);
-	if (!free_block)
+	// Rebuild the tree so the victim and the equal chains follow the new policy
+	victim = nullptr;
+	free_list = nullptr;
+#if USE_SIZE_INDEX
+	if (free_size_index)
+		new(free_size_index) SizeIndex();
+#endif
+	for (SystemAllocation * allocation = first_system_allocation; allocation; allocation = allocation->next)
+		for (Block * block = allocation->start->next; block != allocation->end; block = block->next)
+			if (block->status == BlockStatus::Free)
+			{
+				FreeBlock * const free_block = static_cast<FreeBlock *>(block);
+				free_block->less = nullptr;
+				free_block->equal = nullptr;
+				free_block->greater = nullptr;
+				free_block->parent = nullptr;
+				addToFreeList(free_block);
+			}
+}
+
+ThreeHeap * ThreeHeap::findHeap(void const * const memory)
+{
+	return owningHeap(PageMap::get(memory));
+}
+
+ThreeHeap * ThreeHeap::owningHeap(uintptr_t const page)
+{
+	switch (PageMap::tier(page))
 	{
-		allocateFromSystem(block_size);
-		free_block = searchFreeList(block_size);
-		assert(free_block);
+		case PageTier::Blocks:
+			return static_cast<SystemAllocation const *>(PageMap::owner(page))->heap;
+		case PageTier::Guarded:
+			return static_cast<GuardedPool const *>(PageMap::owner(page))->heap;
+		default:
+			return nullptr;
 	}
+}
 
-	removeFromFreeList(free_block);
-	assert(free_block->less == nullptr);
-	assert(free_block->equal == nullptr);
-	assert(free_block->greater == nullptr);
-	assert(free_block->parent == nullptr);
+void * ThreeHeap::own(void * const memory, void * const owner)
+{
+	HEAP_LOCK();
 
-	AllocatedBlock * allocated_block = static_cast<AllocatedBlock *>(static_cast<Block *>(free_block));
+	uintptr_t const page = PageMap::get(memory);
+	bool const owned = owningHeap(page) == this;
+
+#if USE_GUARDED_SAMPLING
+	if (owned && PageMap::tier(page) == PageTier::Guarded)
+	{
+		GuardedPool::Slot & slot = guarded_pool->slot(memory);
+		if (!slot.allocated || slot.memory != memory)
+		{
+			reportInvalidFree(memory, zero);
+			return nullptr;
+		}
+		transferOwner(slot.owner, owner, slot.size);
+		slot.owner = owner;
+		return memory;
+	}
+#endif
+
+	AllocatedBlock * const allocated_block = owned ? findAllocatedBlock(memory, page) : nullptr;
+	if (!allocated_block)
+	{
+		reportInvalidFree(memory, zero);
+		return nullptr;
+	}
+	transferOwner(allocated_block->owner, owner, allocated_block->allocation_size);
+	allocated_block->owner = owner;
+	return memory;
+}
+
+void ThreeHeap::transferOwner(void const * const from, void const * const to, int64_t const size)
+{
+#if USE_OWNER_STATISTICS
+	if (owner_table)
+	{
+		OwnerStatistics & previous = ownerStatistics(from);
+		--previous.current_number_of_allocations;
+		previous.current_number_of_bytes_allocated -= size;
+		OwnerStatistics & current = ownerStatistics(to);
+		++current.current_number_of_allocations;
+		current.current_number_of_bytes_allocated += size;
+	}
+#endif
+}
+
+void * ThreeHeap::allocate(int64_t const size, int const alignment, Flags const oflags, void * const owner)
+{
+	HEAP_LOCK();
+
+	Flags combined_flags = oflags | heap_flags;
+
+#if USE_GUARDED_SAMPLING
+	// Unsampled allocations only pay for the countdown, and guarded slots are only aligned to SlotAlignment
+	if (--guarded_countdown <= 0 && alignment <= GuardedPool::SlotAlignment)
+		if (void * const result = allocateGuarded(size, combined_flags, owner))
+			return result;
+#endif
+
+	// Sampled allocations get the debug features on top of the heap's own
+	if (--debug_countdown <= 0)
+	{
+		combined_flags |= debug_sample_flags;
+		debug_countdown = NextUniformInterval(debug_random, debug_sample_rate);
+	}
+	int const guard_band_size = combined_flags.useGuardBands() ? GuardBandSize : 0;
+
+	// calculate the total size of the allocation block
+	const int64_t padding = Padding(size, Alignment);
+	const int64_t additional_alignment = (alignment > Alignment) ? alignment : 0;
+	assert(additional_alignment == 0);
+	const int64_t exact_block_size = HeaderSize + guard_band_size + size + padding + additional_alignment + guard_band_size; 
+	const int64_t block_size = (placement == PlacementPolicy::SizeClassBestFit) ? SizeClass(exact_block_size) : exact_block_size;
+
+	FreeBlock * free_block = nullptr;
+#if USE_FAST_BINS
+	// A recently freed block of exactly this size is reused without touching the tree or its neighbors
+	int const bin = static_cast<int>(block_size / Alignment) - 1;
+	if (bin < NumberOfFastBins && fast_bins[bin])
+	{
+		free_block = fast_bins[bin];
+		fast_bins[bin] = free_block->less;
+		fast_bin_bytes -= block_size;
+		free_block->less = nullptr;
+		assert(free_block->status == BlockStatus::Binned);
+	}
+	else
+#endif
+	{
+		// Search for best node to use for this allocation
+		free_block = searchFreeList(block_size);
+#if USE_DESIGNATED_VICTIM
+		// dlmalloc's last remainder rule: a small request the tree has no exact fit for is carved from the victim, so runs of
+		// small allocations stay together in address order.  Anything else only falls back on it rather than growing the heap.
+		// There is only a victim for BestFit and SizeClassBestFit
+		if (victim && victim->size >= block_size && (!free_block || (block_size <= VictimMaximumSize && free_block->size != block_size)))
+		{
+			free_block = victim;
+			victim = nullptr;
+		}
+		else
+#endif
+		{
+#if USE_FAST_BINS
+			// Binned blocks may coalesce into a fit, so they go back before asking the system for more
+			if (!free_block && fast_bin_bytes)
+			{
+				consolidateFastBins();
+				free_block = searchFreeList(block_size);
+			}
+#endif
+			if (!free_block)
+			{
+				allocateFromSystem(block_size);
+				free_block = searchFreeList(block_size);
+				assert(free_block);
+			}
+
+			removeFromFreeList(free_block);
+			assert(free_block->less == nullptr);
+			assert(free_block->equal == nullptr);
+			assert(free_block->greater == nullptr);
+			assert(free_block->parent == nullptr);
+		}
+	}
+
+	AllocatedBlock * allocated_block = static_cast<AllocatedBlock *>(static_cast<Block *>(free_block));
 	allocated_block->status = BlockStatus::Allocated;
 	allocated_block->allocation_size = size;
 	allocated_block->flags = combined_flags;
 	allocated_block->owner = owner;
+	allocated_block->handle = 0;
+	BlockContents const contents = allocated_block->contents;
+	allocated_block->contents = BlockContents::Unknown;
+#if USE_LIFETIME_STATISTICS
+	allocated_block->timestamp = combined_flags.trackLifetimes() ? getTimestamp() : 0;
+#endif
 	free_block = nullptr;
 
 	// Check if there's sufficient size left over to split this block
 	const int64_t remainder_size = allocated_block->size - block_size;
-	if (remainder_size >= SplitSize)
+	bool const split = remainder_size >= SplitSize;
+	if (split)
 	{
 		// Trim this block
 		allocated_block->size = block_size;
@@ -672,16 +1866,36 @@ void * ThreeHeap::allocate(int64_t const size, int const alignment, Flags const
 		remainder_block->status = BlockStatus::Unknown;
 
 		remainder_block->status = BlockStatus::Free;
+		remainder_block->contents = contents;
+#if USE_DESIGNATED_VICTIM
+		// The newest remainder of a small request takes over as the victim, the previous one goes back into the tree
+		if ((placement == PlacementPolicy::BestFit || placement == PlacementPolicy::SizeClassBestFit) && block_size <= VictimMaximumSize)
+		{
+			if (victim)
+				addToFreeList(victim);
+			victim = remainder_block;
+		}
+		else
+#endif
 		addToFreeList(remainder_block);
 	}
 
+	if (placement == PlacementPolicy::NextFit)
+		next_fit = allocated_block;
+
 	intptr_t const allocated_address = reinterpret_cast<intptr_t>(allocated_block);
 
+#if USE_FILL_FREES
+	// Unfilled bits may only cover free memory, never the client's memory or the remainder's header
+	if (heap_flags.lazyFillFrees())
+		clearUnfilled(findSystemAllocation(allocated_block), allocated_address + HeaderSize, allocated_block->size - HeaderSize + (split ? HeaderSize : 0));
+#endif
+
 	if (guard_band_size)
 	{
-		memset(reinterpret_cast<void*>(allocated_address + HeaderSize), GuardBandFillChar, guard_band_size);
+		Fill(reinterpret_cast<void*>(allocated_address + HeaderSize), GuardBandFillChar, guard_band_size);
 		int const post_size = Padding(size, guard_band_size) + guard_band_size;
-		memset(reinterpret_cast<void*>(allocated_address + HeaderSize + guard_band_size + size), GuardBandFillChar, post_size);
+		Fill(reinterpret_cast<void*>(allocated_address + HeaderSize + guard_band_size + size), GuardBandFillChar, post_size);
 	}
 
 	// Update metrics
@@ -695,41 +1909,96 @@ void * ThreeHeap::allocate(int64_t const size, int const alignment, Flags const
 	if (current_bytes_allocated > maximum_bytes_allocated)
 		maximum_bytes_allocated = current_bytes_allocated;
 
-	current_bytes_free -= block_size;
-	total_bytes_used += block_size;
-	current_bytes_used += block_size;
+	// Blocks too small to split keep their slack, which releaseBlock gives back along with the rest of the block
+	current_bytes_free -= allocated_block->size;
+	total_bytes_used += allocated_block->size;
+	current_bytes_used += allocated_block->size;
 	if (current_bytes_used > maximum_bytes_used)
 		maximum_bytes_used = current_bytes_used;
 
+#if USE_OWNER_STATISTICS
+	if (owner_table)
+	{
+		OwnerStatistics & statistics = ownerStatistics(owner);
+		++statistics.current_number_of_allocations;
+		statistics.current_number_of_bytes_allocated += size;
+		++statistics.total_number_of_allocations;
+	}
+#endif
+
 	// Return a pointer to the client memory
 	void * const result = reinterpret_cast<void *>(allocated_address + HeaderSize + guard_band_size);
 
+	if (combined_flags.IsMallocCalloc())
+	{
+		// Only memory that isn't known to be zero needs clearing
+		if (contents != BlockContents::Zero)
+			memset(result, 0, size);
+	}
 #if USE_FILL_ALLOCATIONS
-	if (combined_flags.fillAllocations())
-		memset(result, AllocationFillChar, size);
+	else if (combined_flags.fillAllocations())
+		Fill(result, AllocationFillChar, size, NonTemporalAllocationFillSize);
+#endif
+
+#if USE_HEAP_PROFILE
+	// Unsampled allocations only pay for the countdown
+	profile_bytes_until_sample -= size;
+	if (profile_bytes_until_sample < 0)
+		sampleAllocation(allocated_block, result, size);
 #endif
 
 	REPORT_OPERATION(result, size, alignment, owner, combined_flags | report_allocation);
 	return result;
 }
 
-void ThreeHeap::verifyFree(void const * const memory, int const size) const
+void * ThreeHeap::allocateAtLeast(int64_t const size, int const alignment, Flags const flags, int64_t & usable_size, void * const owner)
 {
-	for (int i = 0; i < size; ++i)
-		if (reinterpret_cast<const char*>(memory)[i] != FreeFillChar)
-		{
-			ErrorInfo info;
-			info.type = ErrorInfo::Type::FreeCorruption;
-			info.memory = memory;
-			info.size = size;
-			info.free_corrupt_index = i;
-			external.error(info);
-			return;
-		}
+	void * const result = allocate(size, alignment, flags, owner);
+	usable_size = getUsableSize(result);
+	return result;
+}
+
+void ThreeHeap::verifyFree(void const * const memory, int64_t const size, char const value) const
+{
+	int64_t const index = FindMismatch(memory, size, value);
+	if (index != size)
+	{
+		ErrorInfo info;
+		info.type = ErrorInfo::Type::FreeCorruption;
+		info.memory = memory;
+		info.size = size;
+		info.free_corrupt_index = static_cast<int>(index);
+		external.error(info);
+	}
+}
+
+void ThreeHeap::verifyFreeBlock(SystemAllocation const * const allocation, Block const * const block) const
+{
+	intptr_t const memory = reinterpret_cast<intptr_t>(block) + HeaderSize;
+	int64_t const size = block->size - HeaderSize;
+	if (!allocation->unfilled)
+	{
+		verifyFree(reinterpret_cast<void *>(memory), size, FreeFillChar);
+		return;
+	}
+
+	// Only the runs that have had their lazy fill done can be checked
+	int64_t const end = allocation->granule(memory + size);
+	for (int64_t granule = allocation->granule(memory); granule < end; )
+	{
+		int64_t const filled_end = FindBit(allocation->unfilled, granule, end, true);
+		if (filled_end > granule)
+			verifyFree(reinterpret_cast<void *>(allocation->address(granule)), (filled_end - granule) * Alignment, FreeFillChar);
+		granule = FindBit(allocation->unfilled, filled_end, end, false);
+	}
 }
 
 bool ThreeHeap::verifyGuardBand(void const * const memory, int const size, bool * corrupt)
 {
+	// Only build the byte map once the fast check finds a problem
+	if (FindMismatch(memory, size, GuardBandFillChar) == size)
+		return true;
+
 	bool result = true;
 	for (int i = 0; i < size; ++i)
 		if (reinterpret_cast<const char*>(memory)[i] != GuardBandFillChar)
@@ -746,6 +2015,7 @@ void ThreeHeap::verifyGuardBands(AllocatedBlock const * const block) const
 	ErrorInfo info;
 	intptr_t const block_address = reinterpret_cast<intptr_t>(block);
 	int64_t const allocated_size = block->allocation_size;
+	int const guard_band_size = block->guardBandSize();
 	int const post_size = Padding(allocated_size, guard_band_size) + guard_band_size;
 	bool const pre = verifyGuardBand(reinterpret_cast<void*>(block_address + HeaderSize), guard_band_size, info.pre_guard_band_corrupt);
 	bool const post = verifyGuardBand(reinterpret_cast<void*>(block_address + HeaderSize + guard_band_size + allocated_size), post_size, info.post_guard_band_corrupt);
@@ -763,17 +2033,30 @@ void ThreeHeap::verifyGuardBands(AllocatedBlock const * const block) const
 
 void ThreeHeap::free(void * const memory, Flags const flags)
 {	
+	HEAP_LOCK();
+
 	if (!memory)
 		return;
 
-	intptr_t const block_address = reinterpret_cast<intptr_t>(memory) - HeaderSize - guard_band_size;
-	AllocatedBlock * allocated_block = reinterpret_cast<AllocatedBlock *>(block_address);
-	assert(allocated_block->marker == Block::Marker);
-	assert(allocated_block->previous->next == allocated_block);
-	assert(allocated_block->next->previous == allocated_block);
-	assert(allocated_block->status == BlockStatus::Allocated);
+	// Pointers this heap never handed out are caught without reading the memory in front of them,
+	// and pointers into its blocks that don't start an allocation by checking the header in front of them
+	uintptr_t const page = PageMap::get(memory);
+	bool const owned = owningHeap(page) == this;
 
-	int64_t const allocated_block_size = allocated_block->size;
+#if USE_GUARDED_SAMPLING
+	if (owned && PageMap::tier(page) == PageTier::Guarded)
+	{
+		freeGuarded(memory, flags);
+		return;
+	}
+#endif
+
+	AllocatedBlock * const allocated_block = owned ? findAllocatedBlock(memory, page) : nullptr;
+	if (!allocated_block)
+	{
+		reportInvalidFree(memory, flags);
+		return;
+	}
 	int64_t const allocated_size = allocated_block->allocation_size;
 	// Make sure the allocation flags match the delete flags
 	Flags const allocated_flags = allocated_block->flags;
@@ -795,24 +2078,74 @@ void ThreeHeap::free(void * const memory, Flags const flags)
 	++total_number_of_frees;
 	--current_number_of_allocations;
 	current_bytes_allocated -= allocated_size;
-	current_bytes_used -= allocated_block_size;
-	current_bytes_free += allocated_block_size;
+
+#if USE_OWNER_STATISTICS
+	if (owner_table)
+	{
+		OwnerStatistics & statistics = ownerStatistics(allocated_block->owner);
+		--statistics.current_number_of_allocations;
+		statistics.current_number_of_bytes_allocated -= allocated_size;
+
+#if USE_LIFETIME_STATISTICS
+		if (allocated_flags.trackLifetimes())
+			recordLifetime(allocated_block, statistics);
+#endif
+	}
+#endif
+
+#if USE_HEAP_PROFILE
+	if (allocated_flags.isSampled())
+		sampleFree(memory);
+#endif
 
 	// Report the operation
 	REPORT_OPERATION(memory, allocated_size, 0, allocated_block->owner, allocated_block->flags | report_free);
 
 #if USE_VERIFY_GUARD_BANDS
-	if (guard_band_size)
+	if (allocated_flags.useGuardBands())
 		verifyGuardBands(allocated_block);
 #endif
 
+#if USE_QUARANTINE
+	if (quarantine && quarantine->budget)
+	{
+		quarantineBlock(allocated_block);
+		return;
+	}
+#endif
+
+#if USE_FAST_BINS
+	// Blocks waiting for a free fill have to go through releaseBlock
+	if (allocated_block->size <= NumberOfFastBins * Alignment && fast_bin_limit && !(flags | allocated_flags).fillFrees())
+	{
+		binBlock(allocated_block);
+		return;
+	}
+#endif
+
+	releaseBlock(allocated_block, flags | allocated_flags, false);
+}
+
+void ThreeHeap::releaseBlock(AllocatedBlock * allocated_block, Flags const combined_flags, bool const filled)
+{
+	int64_t const allocated_block_size = allocated_block->size;
+	current_bytes_used -= allocated_block_size;
+	current_bytes_free += allocated_block_size;
+
 #if USE_FILL_FREES
-	Flags const combined_flags = flags | heap_flags;
-	if (combined_flags.fillFrees())
+	// Lazy fills only mark the memory as unfilled, flushFreeFills() fills it in later
+	bool const fill = combined_flags.fillFrees();
+	SystemAllocation * const unfilled_allocation = (fill && heap_flags.lazyFillFrees()) ? findSystemAllocation(allocated_block) : nullptr;
+	if (!filled)
 	{
-		intptr_t user = reinterpret_cast<intptr_t>(allocated_block) + HeaderSize;
-		memset(reinterpret_cast<void *>(user), FreeFillChar, allocated_block_size - HeaderSize);
+		intptr_t const user = reinterpret_cast<intptr_t>(allocated_block) + HeaderSize;
+		if (unfilled_allocation)
+			markUnfilled(unfilled_allocation, user, allocated_block_size - HeaderSize);
+		else if (fill)
+			Fill(reinterpret_cast<void *>(user), FreeFillChar, allocated_block_size - HeaderSize);
 	}
+#else
+	bool const fill = false;
 #endif
 
 	// Convert this previously allocated block to a free block
@@ -821,12 +2154,17 @@ void ThreeHeap::free(void * const memory, Flags const flags)
 	allocated_block->owner = nullptr;
 	allocated_block = nullptr;
 	free_block->fixed = 0;
+	free_block->idle = 0;
+	free_block->contents = (filled || fill) ? BlockContents::FreeFilled : BlockContents::Unknown;
 	free_block->status = BlockStatus::Unknown;
 	free_block->less = nullptr;
 	free_block->equal = nullptr;
 	free_block->greater = nullptr;
 	free_block->parent = nullptr;
 
+	// Blocks that coalesce with the victim become the victim rather than going into the tree
+	bool merged_victim = false;
+
 	// Coalesce with the next block if it is free
 	Block * next = free_block->next;
 	if (next->status == BlockStatus::Free)
@@ -834,23 +2172,40 @@ void ThreeHeap::free(void * const memory, Flags const flags)
 		// Remove the next free block from the free list
 		FreeBlock * const free_next = static_cast<FreeBlock *>(next);
 		
-		removeFromFreeList(free_next);
+		if (free_next == victim)
+		{
+			victim = nullptr;
+			merged_victim = true;
+		}
+		else
+			removeFromFreeList(free_next);
 		assert(free_next->less == nullptr);
 		assert(free_next->equal == nullptr);
 		assert(free_next->greater == nullptr);
 		assert(free_next->parent == nullptr);
 
 		// Collapse it into the current block
+		if (next_fit == next)
+			next_fit = free_block;
+		if (verify_block == next)
+			verify_block = free_block;
 		Block * const next_next = next->next;
 		free_block->size += next->size;
 		free_block->next = next_next;
 		next_next->previous = free_block;
 
+		// The coalesced block only keeps its contents if both halves had the same
+		BlockContents const contents = (free_block->contents == next->contents) ? next->contents : BlockContents::Unknown;
+		free_block->contents = contents;
+
 #if USE_FILL_FREES
-		if (combined_flags.fillFrees())
-			memset(reinterpret_cast<void *>(next), FreeFillChar, HeaderSize);
+		if (contents == BlockContents::FreeFilled && !unfilled_allocation)
+			Fill(reinterpret_cast<void *>(next), FreeFillChar, HeaderSize);
 		else
 #endif
+		if (contents == BlockContents::Zero)
+			memset(reinterpret_cast<void *>(next), 0, HeaderSize);
+		else
 		{
 			// Destroy the node we are collapsing into this node
 			next->marker = 0;
@@ -860,6 +2215,11 @@ void ThreeHeap::free(void * const memory, Flags const flags)
 			next->next = nullptr;
 		}
 
+#if USE_FILL_FREES
+		if (contents == BlockContents::FreeFilled && unfilled_allocation)
+			markUnfilled(unfilled_allocation, reinterpret_cast<intptr_t>(next), HeaderSize);
+#endif
+
 		// Our next is the next
 		next = next_next;
 	}
@@ -871,23 +2231,40 @@ void ThreeHeap::free(void * const memory, Flags const flags)
 		const int64_t additional_size = free_block->size;
 
 		FreeBlock * const free_previous = static_cast<FreeBlock *>(previous);
-		removeFromFreeList(free_previous);
+		if (free_previous == victim)
+		{
+			victim = nullptr;
+			merged_victim = true;
+		}
+		else
+			removeFromFreeList(free_previous);
 		assert(free_previous->less == nullptr);
 		assert(free_previous->equal == nullptr);
 		assert(free_previous->greater == nullptr);
 		assert(free_previous->parent == nullptr);
 
 		// Collapse the current free block into the previous
+		if (next_fit == free_block)
+			next_fit = free_previous;
+		if (verify_block == free_block)
+			verify_block = free_previous;
 		free_previous->status = BlockStatus::Unknown;
+		free_previous->idle = 0;
 		free_previous->size += additional_size;
 		free_previous->next = next;
 		next->previous = free_previous;
 
+		BlockContents const contents = (free_previous->contents == free_block->contents) ? free_block->contents : BlockContents::Unknown;
+		free_previous->contents = contents;
+
 #if USE_FILL_FREES
-		if (combined_flags.fillFrees())
-			memset(reinterpret_cast<void *>(free_block), FreeFillChar, HeaderSize);
+		if (contents == BlockContents::FreeFilled && !unfilled_allocation)
+			Fill(reinterpret_cast<void *>(free_block), FreeFillChar, HeaderSize);
 		else
 #endif
+		if (contents == BlockContents::Zero)
+			memset(reinterpret_cast<void *>(free_block), 0, HeaderSize);
+		else
 		{
 			// Destroy the current free block that was collapsed into the previous
 			free_block->marker = 0;
@@ -897,139 +2274,1679 @@ void ThreeHeap::free(void * const memory, Flags const flags)
 			free_block->next = nullptr;
 		}
 
+#if USE_FILL_FREES
+		if (contents == BlockContents::FreeFilled && unfilled_allocation)
+			markUnfilled(unfilled_allocation, reinterpret_cast<intptr_t>(free_block), HeaderSize);
+#endif
+
 		// The free block is now the previous free block
 		free_block = free_previous;
 	}
 
 	free_block->status = BlockStatus::Free;
-	addToFreeList(free_block);
+	if (merged_victim)
+		victim = free_block;
+	else
+		addToFreeList(free_block);
 }
 
 int64_t ThreeHeap::getAllocationSize(void * const memory) const
 {
+	HEAP_LOCK();
+
 	if (!memory)
 		return 0;
 
-	Block const * const block = reinterpret_cast<Block const *>(reinterpret_cast<intptr_t>(memory) - HeaderSize);
-	assert(block->marker == Block::Marker);
-	assert(block->status == BlockStatus::Allocated);
+	uintptr_t const page = PageMap::get(memory);
+	if (owningHeap(page) != this)
+		return 0;
+
+#if USE_GUARDED_SAMPLING
+	if (PageMap::tier(page) == PageTier::Guarded)
+		return guarded_pool->slot(memory).size;
+#endif
 
-	AllocatedBlock const * const allocated_block = static_cast<AllocatedBlock const *>(block);
-	return allocated_block->allocation_size;
+	AllocatedBlock const * const block = findAllocatedBlock(memory, page);
+	return block ? block->allocation_size : 0;
 }
 
-void ThreeHeap::verify(FreeBlock const * const parent, FreeBlock const * const node, int & number_of_free_blocks) const
+int64_t ThreeHeap::getUsableSize(void * const memory) const
 {
-	++number_of_free_blocks;
+	HEAP_LOCK();
 
-	assert(node->marker == Block::Marker);
-	assert(node->status == BlockStatus::Free);
-	assert(node->size >= (HeaderSize + HeaderSize));
-	assert((node->size % Alignment) == 0);
+	if (!memory)
+		return 0;
 
-	if (FreeBlock const * less = node->less; less)
-	{
-		assert(less->size < node->size);
-		assert(less->parent == node);
-		verify(node, less, number_of_free_blocks);
-	}
-	if (FreeBlock const * greater = node->greater; greater)
+	uintptr_t const page = PageMap::get(memory);
+	if (owningHeap(page) != this)
+		return 0;
+
+#if USE_GUARDED_SAMPLING
+	// Guarded allocations are right aligned against their guard page
+	if (PageMap::tier(page) == PageTier::Guarded)
+		return GuardedPool::PageSize - (reinterpret_cast<intptr_t>(memory) & (GuardedPool::PageSize - 1));
+#endif
+
+	// The slack after a guarded allocation belongs to its guard band
+	AllocatedBlock const * const block = findAllocatedBlock(memory, page);
+	if (!block)
+		return 0;
+	if (block->flags.useGuardBands())
+		return block->allocation_size;
+	return block->size - HeaderSize;
+}
+
+ThreeHeap::AllocatedBlock * ThreeHeap::findAllocatedBlock(void const * const memory, uintptr_t const page) const
+{
+	// Client memory in blocks is always Alignment aligned, with the header or a guard band and then the header in front of it.
+	// The probes only read pages with the same page map entry as the memory, and a header only counts if it is allocated and
+	// starts exactly this memory, so interior and misaligned pointers are rejected.  Client data that holds a copy of a
+	// live header in front of an interior pointer can't be told apart from the real thing.
+	intptr_t const address = reinterpret_cast<intptr_t>(memory);
+	if (address & (Alignment - 1))
+		return nullptr;
+
+	intptr_t header = address - HeaderSize;
+	for (int probe = 0; probe < 2; ++probe, header -= GuardBandSize)
 	{
-		assert(greater->size > node->size);
-		assert(greater->parent == node);
-		verify(node, greater, number_of_free_blocks);
+		if (PageMap::get(reinterpret_cast<void const *>(header)) != page)
+			return nullptr;
+
+		AllocatedBlock * const block = reinterpret_cast<AllocatedBlock *>(header);
+		if (block->marker == Block::Marker)
+			return (block->status == BlockStatus::Allocated && block->memory() == memory) ? block : nullptr;
 	}
-	if (FreeBlock const * equal = node->equal; equal)
+	return nullptr;
+}
+
+void ThreeHeap::reportInvalidFree(void * const memory, Flags const flags)
+{
+	ErrorInfo info;
+	info.type = ErrorInfo::Type::InvalidFree;
+	info.memory = memory;
+	info.free_flags = flags;
+	external.error(info);
+}
+
+ThreeHeap::AllocatedBlock * ThreeHeap::getAllocatedBlock(void const * const memory) const
+{
+	// A guard band sits between the header and the client memory for the blocks that have one,
+	// and an intact guard band never holds the header marker
+	intptr_t const address = reinterpret_cast<intptr_t>(memory);
+	AllocatedBlock * block = reinterpret_cast<AllocatedBlock *>(address - HeaderSize);
+	if (block->marker != Block::Marker)
 	{
-		assert(equal->parent == node);
-		assert(equal->size == node->size);
-		verify(node, equal, number_of_free_blocks);
+		block = reinterpret_cast<AllocatedBlock *>(address - HeaderSize - GuardBandSize);
+		assert(block->flags.useGuardBands());
 	}
-	assert(node->parent == parent);
+	assert(block->marker == Block::Marker);
+	assert(block->previous->next == block);
+	assert(block->next->previous == block);
+	assert(block->status == BlockStatus::Allocated);
+	return block;
 }
 
-void ThreeHeap::verify(Flags flags) const
+int ThreeHeap::verifyFreeTree() const
 {
+	int number_of_free_blocks = 0;
 #if USE_ASSERT
-	// Limit the verification to features supported in the heap
-	bool const check_free = flags.validateFree() && heap_flags.fillFrees();
-
-	// Check all the system allocation doubly linked list
-	int free_blocks_linear = 0;
-	for (SystemAllocation * allocation = first_system_allocation; allocation; allocation = allocation->next)
+	// Walk the tree with the parent pointers rather than recursion, so a degenerate tree can't overflow the stack.
+	// Each child's parent pointer is checked before stepping down to it, since the walk relies on them to come back up
+	FreeBlock const * previous = nullptr;
+	for (FreeBlock const * node = free_list; node; )
 	{
-		// Linearly scan all the blocks in the system allocation
-		for (Block const * block = allocation->start->next; block != allocation->end; block = block->next)
+		FreeBlock const * const less = node->less;
+		FreeBlock const * const greater = node->greater;
+		FreeBlock const * const equal = node->equal;
+
+		FreeBlock const * child = nullptr;
+		if (previous == node->parent)
 		{
-			Block const * const previous = block->previous;
-			Block const * const next = block->next;
+			// First visit to this node
+			++number_of_free_blocks;
+			assert(node->marker == Block::Marker);
+			assert(node->status == BlockStatus::Free);
+			assert(node->size >= (HeaderSize + HeaderSize));
+			assert((node->size % Alignment) == 0);
+			assert(!less || less->size < node->size);
+			assert(!greater || greater->size > node->size);
+			assert(!equal || equal->size == node->size);
+			assert(!less || less->parent == node);
+			assert(!greater || greater->parent == node);
+			assert(!equal || equal->parent == node);
+
+			child = less ? less : greater ? greater : equal;
+		}
+		else if (previous == less)
+			child = greater ? greater : equal;
+		else if (previous == greater)
+			child = equal;
 
-			if (block->status == BlockStatus::Free)
-				++free_blocks_linear;
+		previous = node;
+		node = child ? child : node->parent;
+	}
+#endif
+	return number_of_free_blocks;
+}
 
-			assert(block->marker == Block::Marker);
-			assert(block->status == BlockStatus::Unknown || block->status == BlockStatus::Sentinel || block->status == BlockStatus::Free || block->status == BlockStatus::Allocated);
-			assert((block->size & (AllocationPad - 1)) == 0);
-			assert(reinterpret_cast<intptr_t>(block->next) == (reinterpret_cast<intptr_t>(block) + (block->fixed ? HeaderSize : block->size)));
-			assert(next->previous == block);
-			assert(previous->next == block);
+bool ThreeHeap::verifyBlock(SystemAllocation const * const allocation, Block const * const block, Flags const flags) const
+{
+#if USE_ASSERT
+	Block const * const previous = block->previous;
+	Block const * const next = block->next;
+
+	assert(block->marker == Block::Marker);
+	assert(block->status == BlockStatus::Unknown || block->status == BlockStatus::Sentinel || block->status == BlockStatus::Free || block->status == BlockStatus::Allocated || block->status == BlockStatus::Quarantined || block->status == BlockStatus::Binned);
+	assert((block->size & (AllocationPad - 1)) == 0);
+	assert(reinterpret_cast<intptr_t>(block->next) == (reinterpret_cast<intptr_t>(block) + (block->fixed ? HeaderSize : block->size)));
+	assert(next->previous == block);
+	assert(previous->next == block);
 
 #if USE_VERIFY_GUARD_BANDS
-			if (guard_band_size && flags.validateGuardBands() && block->status == BlockStatus::Allocated)
-				verifyGuardBands(static_cast<AllocatedBlock const *>(block));
+	if (flags.validateGuardBands() && block->status == BlockStatus::Allocated && static_cast<AllocatedBlock const *>(block)->flags.useGuardBands())
+		verifyGuardBands(static_cast<AllocatedBlock const *>(block));
 #endif
 
 #if USE_FILL_FREES && USE_VERIFY_FREES
-			if (check_free && block->status == BlockStatus::Free && !block->fixed)
-			{
-				intptr_t const memory = reinterpret_cast<intptr_t>(block) + HeaderSize;
-				verifyFree(reinterpret_cast<void *>(memory), block->size - HeaderSize);
-			}
+	// Only blocks that were free filled or zero throughout can be checked
+	if (flags.validateFree() && block->status == BlockStatus::Free && block->contents == BlockContents::FreeFilled && !block->fixed)
+		verifyFreeBlock(allocation, block);
+	if (flags.validateFree() && block->status == BlockStatus::Free && block->contents == BlockContents::Zero && !block->fixed)
+		verifyFree(reinterpret_cast<void const *>(reinterpret_cast<intptr_t>(block) + HeaderSize), block->size - HeaderSize, 0);
 #endif
-		}
-	}
 
-	// Verify all the free nodes can be found in the free list
-	if (free_list)
-	{
-		int free_blocks_tree = 0;
-		verify(nullptr, free_list, free_blocks_tree);
-		assert(free_blocks_linear == free_blocks_tree);
-	}
+#if USE_QUARANTINE && USE_VERIFY_FREES
+	// Quarantined blocks are always filled
+	if (flags.validateFree() && block->status == BlockStatus::Quarantined)
+		verifyFree(reinterpret_cast<void const *>(reinterpret_cast<intptr_t>(block) + HeaderSize), block->size - HeaderSize, FreeFillChar);
 #endif
+#endif
+	return block->status == BlockStatus::Free;
 }
 
-void ThreeHeap::report_allocations() const
+int ThreeHeap::verifySystemAllocation(SystemAllocation const * const allocation, Flags const flags) const
 {
+	// Linearly scan all the blocks in the system allocation
+	int free_blocks = 0;
+	for (Block const * block = allocation->start->next; block != allocation->end; block = block->next)
+		if (verifyBlock(allocation, block, flags))
+			++free_blocks;
+	return free_blocks;
+}
+
+void ThreeHeap::verify(Flags flags) const
+{
+	HEAP_LOCK();
+
+#if USE_ASSERT
 	// Check all the system allocation doubly linked list
-	for (SystemAllocation const * allocation = first_system_allocation; allocation; allocation = allocation->next)
-	{
-		// Linearly scan all the blocks in the system allocation
-		for (Block const * block = allocation->start->next; block != allocation->end; block = block->next)
-			if (block->status == BlockStatus::Allocated)
-			{
-				AllocatedBlock const * const allocated_block = static_cast<AllocatedBlock const *>(block);
-				void const * const mem = reinterpret_cast<void *>(reinterpret_cast<intptr_t>(allocated_block) + HeaderSize);
-				external.report_allocations(mem, allocated_block->allocation_size, allocated_block->owner, allocated_block->flags);
+	int free_blocks_linear = 0;
+	for (SystemAllocation * allocation = first_system_allocation; allocation; allocation = allocation->next)
+		free_blocks_linear += verifySystemAllocation(allocation, flags);
 
-#if 0
-				// Look up the source location and report where the leak came from
-				// char ** backtrace_symbols (void *const *buffer, int size)
-				void * owner = const_cast<void*>(allocated_block->owner);
-				char * * result = nullptr;
-				result = backtrace_symbols(&owner, 1);
-				printf("  address %p %s\n", mem, result[0]);
+	assert(free_blocks_linear == verifyFreeStructures());
+	verifyGuardedPool();
 #endif
-			}
+}
+
+void ThreeHeap::verifyGuardedPool() const
+{
+#if USE_ASSERT && USE_GUARDED_SAMPLING
+	// Every live guarded allocation is right aligned against the guard page after its slot's page
+	if (guarded_pool)
+		for (int i = 0; i < GuardedPool::NumberOfSlots; ++i)
+		{
+			GuardedPool::Slot const & slot = guarded_pool->slots[i];
+			if (!slot.allocated)
+				continue;
+
+			intptr_t const memory = reinterpret_cast<intptr_t>(slot.memory);
+			int64_t const rounded = (slot.size ? slot.size : 1) + Padding(static_cast<int>(slot.size ? slot.size : 1), GuardedPool::SlotAlignment);
+			assert(slot.size >= 0 && slot.size <= GuardedPool::PageSize);
+			assert(memory + rounded == guarded_pool->page(i) + GuardedPool::PageSize);
+			assert(PageMap::tier(PageMap::get(slot.memory)) == PageTier::Guarded);
+		}
+#endif
+}
+
+bool ThreeHeap::verifyStep(int64_t const max_blocks, Flags const flags)
+{
+	HEAP_LOCK();
+
+	if (!first_system_allocation)
+		return true;
+	if (!verify_allocation)
+	{
+		verify_allocation = first_system_allocation;
+		verify_block = nullptr;
+	}
+
+	// The cursor block is kept on a live block as blocks coalesce, and compact() sends it back to the start of its system allocation
+	int64_t blocks = 0;
+	for (;;)
+	{
+		if (!verify_block)
+			verify_block = verify_allocation->start->next;
+		for (; verify_block != verify_allocation->end && blocks < max_blocks; verify_block = verify_block->next, ++blocks)
+			verifyBlock(verify_allocation, verify_block, flags);
+		if (verify_block != verify_allocation->end)
+			return false;
+
+		verify_allocation = verify_allocation->next;
+		verify_block = nullptr;
+		if (!verify_allocation)
+			break;
+		if (blocks >= max_blocks)
+			return false;
 	}
+
+	// The blocks were checked over many calls with the heap changing in between, so the free block counts can't be compared.
+	// The free structures are checked whole at the end of each lap
+	verifyFreeStructures();
+	verifyGuardedPool();
+	return true;
 }
 
-void * ThreeHeap::reallocate(void * const memory, int64_t const size)
+void ThreeHeap::verifyParallel(int const number_of_threads, Flags const flags)
 {
-	// @TODO size the block in situ if possible
-	int64_t const previous = getAllocationSize(memory);
-	int64_t const least = (previous < size) ? previous : size;
-	void * const result = allocate(size, 0, malloc);
-	memcpy(result, memory, least);
-	return result;
+#if USE_PARALLEL_VERIFY
+	if (number_of_threads <= 1)
+	{
+		verify(flags);
+		return;
+	}
+
+	HEAP_LOCK();
+
+	if (!verify_pool)
+		verify_pool = new(allocateMetadata(sizeof(VerifyPool))) VerifyPool();
+	VerifyPool & pool = *verify_pool;
+
+	// This thread does its share too
+	int const workers = (number_of_threads - 1 < VerifyPool::MaximumThreads) ? number_of_threads - 1 : VerifyPool::MaximumThreads;
+	// A new worker starts out caught up, the pass it joins is announced below
+	while (pool.number_of_threads < workers)
+		pool.threads[pool.number_of_threads++] = std::thread([this, &pool, generation = pool.generation]() mutable
+		{
+			std::unique_lock<std::mutex> lock(pool.mutex);
+			for (;;)
+			{
+				pool.start.wait(lock, [&] { return pool.stop || pool.generation != generation; });
+				if (pool.stop)
+					return;
+				generation = pool.generation;
+
+				lock.unlock();
+				for (SystemAllocation const * allocation = pool.take(); allocation; allocation = pool.take())
+					pool.free_blocks += verifySystemAllocation(allocation, pool.flags);
+				lock.lock();
+
+				if (--pool.busy == 0)
+					pool.done.notify_one();
+			}
+		});
+
+	// The system allocations don't share any blocks and nothing is written, so the heap lock held here covers the workers
+	{
+		std::lock_guard<std::mutex> const lock(pool.mutex);
+		pool.flags = flags;
+		pool.next_allocation = first_system_allocation;
+		pool.free_blocks = 0;
+		pool.busy = pool.number_of_threads;
+		++pool.generation;
+	}
+	pool.start.notify_all();
+
+#if USE_ASSERT
+	int const free_blocks_structures = verifyFreeStructures();
+	verifyGuardedPool();
+#endif
+	for (SystemAllocation const * allocation = pool.take(); allocation; allocation = pool.take())
+		pool.free_blocks += verifySystemAllocation(allocation, flags);
+
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	pool.done.wait(lock, [&] { return pool.busy == 0; });
+	assert(pool.free_blocks == free_blocks_structures);
+#else
+	verify(flags);
+	(void)number_of_threads;
+#endif
+}
+
+int ThreeHeap::verifyFreeStructures() const
+{
+#if USE_ASSERT
+	// Every binned block is the size of its bin
+	int64_t binned_bytes = 0;
+	for (int bin = 0; bin < NumberOfFastBins; ++bin)
+		for (FreeBlock const * block = fast_bins[bin]; block; block = block->less)
+		{
+			assert(block->marker == Block::Marker);
+			assert(block->status == BlockStatus::Binned);
+			assert(block->size == (bin + 1) * Alignment);
+			binned_bytes += block->size;
+		}
+	assert(binned_bytes == fast_bin_bytes);
+
+	// The victim is the only free block kept out of the tree
+	int free_blocks_tree = 0;
+	if (victim)
+	{
+		assert(victim->status == BlockStatus::Free);
+		assert(victim->less == nullptr && victim->equal == nullptr && victim->greater == nullptr && victim->parent == nullptr);
+		++free_blocks_tree;
+	}
+
+#if USE_SIZE_INDEX
+	// Every indexed block is in the list for its size, and only the sizes with blocks have their bits set
+	if (free_size_index)
+		for (int i = 0; i < SizeIndex::NumberOfSizes; ++i)
+		{
+			FreeBlock const * const head = free_size_index->heads[i];
+			assert(static_cast<bool>(head) == static_cast<bool>(free_size_index->occupied[i >> 6] & (uint64_t(1) << (i & 63))));
+			assert(static_cast<bool>(free_size_index->occupied[i >> 6]) == static_cast<bool>(free_size_index->summary[i >> 12] & (uint64_t(1) << ((i >> 6) & 63))));
+			for (FreeBlock const * block = head; block; block = block->equal)
+			{
+				++free_blocks_tree;
+				assert(block->marker == Block::Marker);
+				assert(block->status == BlockStatus::Free);
+				assert(SizeIndex::index(block->size) == i);
+				assert(block->parent == nullptr || block->parent->equal == block);
+				assert(block->less == nullptr && block->greater == nullptr);
+			}
+		}
+#endif
+
+	// Verify all the free nodes can be found in the free list
+	return free_blocks_tree + verifyFreeTree();
+#else
+	return 0;
+#endif
+}
+
+void ThreeHeap::report_allocations() const
+{
+	HEAP_LOCK();
+
+	// Check all the system allocation doubly linked list
+	for (SystemAllocation const * allocation = first_system_allocation; allocation; allocation = allocation->next)
+	{
+		// Linearly scan all the blocks in the system allocation
+		for (Block const * block = allocation->start->next; block != allocation->end; block = block->next)
+			if (block->status == BlockStatus::Allocated)
+			{
+				AllocatedBlock const * const allocated_block = static_cast<AllocatedBlock const *>(block);
+				void const * const mem = allocated_block->memory();
+				external.report_allocations(mem, allocated_block->allocation_size, allocated_block->owner, allocated_block->flags);
+
+#if 0
+				// Look up the source location and report where the leak came from
+				// char ** backtrace_symbols (void *const *buffer, int size)
+				void * owner = const_cast<void*>(allocated_block->owner);
+				char * * result = nullptr;
+				result = backtrace_symbols(&owner, 1);
+				printf("  address %p %s\n", mem, result[0]);
+#endif
+			}
+	}
+
+#if USE_GUARDED_SAMPLING
+	// Guarded allocations live outside the system allocations
+	if (guarded_pool)
+		for (GuardedPool::Slot const & slot : guarded_pool->slots)
+			if (slot.allocated)
+				external.report_allocations(slot.memory, slot.size, slot.owner, slot.flags);
+#endif
+}
+
+void ThreeHeap::writeSnapshot(int const fd) const
+{
+	HEAP_LOCK();
+
+	OutputBuffer out(fd);
+
+	SnapshotHeader header;
+	header.timestamp = getTimestamp();
+	out.append(&header, sizeof(header));
+
+	for (SystemAllocation const * allocation = first_system_allocation; allocation; allocation = allocation->next)
+		for (Block const * block = allocation->start->next; block != allocation->end; block = block->next)
+			if (block->status == BlockStatus::Allocated)
+			{
+				AllocatedBlock const * const allocated_block = static_cast<AllocatedBlock const *>(block);
+				void const * const memory = allocated_block->memory();
+
+				SnapshotRecord record;
+				record.address = reinterpret_cast<uintptr_t>(memory);
+				record.size = allocated_block->allocation_size;
+				record.owner = reinterpret_cast<uintptr_t>(allocated_block->owner);
+				record.flags = allocated_block->flags.flags;
+
+#if USE_HEAP_PROFILE
+				// Sampled allocations are in the profiler's table, so their call stack is known
+				if (profiler && allocated_block->flags.isSampled())
+				{
+					int const mask = Profiler::SampleCapacity - 1;
+					for (int slot = static_cast<int>(HashPointer(memory)) & mask; profiler->samples[slot].memory; slot = (slot + 1) & mask)
+						if (profiler->samples[slot].memory == memory)
+						{
+							record.stack = profiler->stacks[profiler->samples[slot].stack].hash;
+							break;
+						}
+				}
+#endif
+
+				out.append(&record, sizeof(record));
+			}
+
+#if USE_GUARDED_SAMPLING
+	// Guarded allocations live outside the system allocations, and are never profiled
+	if (guarded_pool)
+		for (GuardedPool::Slot const & slot : guarded_pool->slots)
+			if (slot.allocated)
+			{
+				SnapshotRecord record;
+				record.address = reinterpret_cast<uintptr_t>(slot.memory);
+				record.size = slot.size;
+				record.owner = reinterpret_cast<uintptr_t>(slot.owner);
+				record.flags = slot.flags.flags;
+				out.append(&record, sizeof(record));
+			}
+#endif
+}
+
+void * ThreeHeap::reallocate(void * const memory, int64_t const size)
+{
+	HEAP_LOCK();
+
+	// Memory this heap didn't hand out is reported like a bad free rather than copied from
+	uintptr_t const page = PageMap::get(memory);
+	bool const owned = owningHeap(page) == this;
+	bool const guarded = owned && PageMap::tier(page) == PageTier::Guarded;
+	AllocatedBlock * const block = (owned && !guarded) ? findAllocatedBlock(memory, page) : nullptr;
+	if (memory && !guarded && !block)
+	{
+		reportInvalidFree(memory, malloc);
+		return nullptr;
+	}
+
+	int64_t const previous = getAllocationSize(memory);
+
+	// Resize in place when the new size fits in the slack the block already has, guard bands stay where they are.
+	// Sampled blocks move so the profiler's sample is retired at its old size and retaken at the new one
+	if (block && !block->flags.useGuardBands() && !block->flags.isSampled() && size <= block->size - HeaderSize)
+	{
+		block->allocation_size = size;
+
+		total_bytes_allocated += (size > previous) ? size - previous : 0;
+		current_bytes_allocated += size - previous;
+		if (current_bytes_allocated > maximum_bytes_allocated)
+			maximum_bytes_allocated = current_bytes_allocated;
+
+#if USE_OWNER_STATISTICS
+		if (owner_table)
+			ownerStatistics(block->owner).current_number_of_bytes_allocated += size - previous;
+#endif
+
+#if USE_FILL_ALLOCATIONS
+		if (size > previous && block->flags.fillAllocations())
+			Fill(reinterpret_cast<char *>(memory) + previous, AllocationFillChar, size - previous);
+#endif
+		return memory;
+	}
+
+	// The moved allocation keeps its owner and the flags free() checks against
+	void * owner = nullptr;
+	Flags allocation_flags = malloc;
+	if (block)
+	{
+		owner = block->owner;
+		allocation_flags = block->flags & free_check;
+	}
+#if USE_GUARDED_SAMPLING
+	else if (guarded)
+	{
+		GuardedPool::Slot const & slot = guarded_pool->slot(memory);
+		owner = const_cast<void *>(slot.owner);
+		allocation_flags = slot.flags & free_check;
+	}
+#endif
+
+	int64_t const least = (previous < size) ? previous : size;
+	void * const result = allocate(size, 0, allocation_flags, owner);
+	memcpy(result, memory, least);
+	free(memory, allocation_flags);
+	return result;
+}
+
+// ======================================================================
+
+void * ThreeHeap::allocateMetadata(int64_t const size)
+{
+	// Bookkeeping tables are carved out of system memory that never holds client blocks
+	int64_t const aligned_size = size + Padding(static_cast<int>(size), Alignment);
+	if (metadata_current + aligned_size > metadata_end)
+	{
+		int64_t system_size = aligned_size + Alignment;
+		intptr_t const memory = reinterpret_cast<intptr_t>(external.system_allocator(system_size));
+		metadata_current = memory + Padding(static_cast<int>(memory), Alignment);
+		metadata_end = memory + system_size;
+	}
+
+	void * const result = reinterpret_cast<void *>(metadata_current);
+	metadata_current += aligned_size;
+	return result;
+}
+
+void ThreeHeap::setProfileSampleInterval(int64_t const average_bytes)
+{
+	HEAP_LOCK();
+
+	if (average_bytes <= 0)
+	{
+		// Outstanding samples stay tracked until they are freed
+		if (profiler)
+			profiler->sample_interval = 0;
+		profile_bytes_until_sample = INT64_MAX;
+		return;
+	}
+
+	if (!profiler)
+	{
+		profiler = new(allocateMetadata(sizeof(Profiler))) Profiler();
+
+		// backtrace() lazily loads the unwinder, get that out of the way before the first sample
+		void * frame = nullptr;
+		backtrace(&frame, 1);
+	}
+
+	profiler->sample_interval = average_bytes;
+	profile_bytes_until_sample = NextSampleInterval(profiler->random, average_bytes);
+}
+
+__attribute__((noinline))
+void ThreeHeap::sampleAllocation(AllocatedBlock * const block, void const * const memory, int64_t const size)
+{
+	Profiler & p = *profiler;
+	profile_bytes_until_sample = NextSampleInterval(p.random, p.sample_interval);
+
+	// Skip this function and allocate() so the stack starts at the caller
+	constexpr int SkipFrames = 2;
+	void * frames[Profiler::MaximumStackDepth + SkipFrames];
+	int const captured = backtrace(frames, Profiler::MaximumStackDepth + SkipFrames);
+	int const skip = (captured > SkipFrames) ? SkipFrames : 0;
+	int const depth = captured - skip;
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (int i = 0; i < depth; ++i)
+		hash = (hash ^ reinterpret_cast<uintptr_t>(frames[skip + i])) * 0x100000001b3ull;
+
+	// Both tables are kept under 3/4 full so the probes stay short
+	if (p.number_of_samples >= Profiler::SampleCapacity / 4 * 3)
+	{
+		++p.dropped_samples;
+		return;
+	}
+
+	// Find or add the call stack
+	int const stack_mask = Profiler::StackCapacity - 1;
+	int stack = static_cast<int>(hash) & stack_mask;
+	for (;; stack = (stack + 1) & stack_mask)
+	{
+		Profiler::Stack & entry = p.stacks[stack];
+		if (entry.depth == 0)
+		{
+			if (p.number_of_stacks >= Profiler::StackCapacity / 4 * 3)
+			{
+				++p.dropped_samples;
+				return;
+			}
+			++p.number_of_stacks;
+			entry.hash = hash;
+			entry.depth = depth;
+			memcpy(entry.frames, frames + skip, depth * sizeof(void *));
+			break;
+		}
+		if (entry.hash == hash && entry.depth == depth && memcmp(entry.frames, frames + skip, depth * sizeof(void *)) == 0)
+			break;
+	}
+
+	Profiler::Stack & entry = p.stacks[stack];
+	++entry.live_count;
+	entry.live_bytes += size;
+	++entry.total_count;
+	entry.total_bytes += size;
+
+	// Track the allocation until it is freed
+	int const sample_mask = Profiler::SampleCapacity - 1;
+	int slot = static_cast<int>(HashPointer(memory)) & sample_mask;
+	while (p.samples[slot].memory)
+		slot = (slot + 1) & sample_mask;
+	p.samples[slot].memory = memory;
+	p.samples[slot].size = size;
+	p.samples[slot].stack = stack;
+	++p.number_of_samples;
+
+	block->flags |= Flags{Flags::flag_sampled};
+}
+
+void ThreeHeap::sampleFree(void const * const memory)
+{
+	Profiler & p = *profiler;
+	int const mask = Profiler::SampleCapacity - 1;
+	int slot = static_cast<int>(HashPointer(memory)) & mask;
+	while (p.samples[slot].memory != memory)
+	{
+		assert(p.samples[slot].memory);
+		if (!p.samples[slot].memory)
+			return;
+		slot = (slot + 1) & mask;
+	}
+
+	Profiler::Stack & entry = p.stacks[p.samples[slot].stack];
+	--entry.live_count;
+	entry.live_bytes -= p.samples[slot].size;
+	--p.number_of_samples;
+
+	// Backward shift deletion keeps the probe sequences intact without tombstones
+	int hole = slot;
+	for (int next = (hole + 1) & mask; p.samples[next].memory; next = (next + 1) & mask)
+	{
+		int const home = static_cast<int>(HashPointer(p.samples[next].memory)) & mask;
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			p.samples[hole] = p.samples[next];
+			hole = next;
+		}
+	}
+	p.samples[hole] = Profiler::Sample();
+}
+
+void ThreeHeap::writeHeapProfile(int const fd) const
+{
+	HEAP_LOCK();
+
+	OutputBuffer out(fd);
+
+	int64_t live_count = 0;
+	int64_t live_bytes = 0;
+	int64_t total_count = 0;
+	int64_t total_bytes = 0;
+	if (profiler)
+		for (Profiler::Stack const & entry : profiler->stacks)
+		{
+			live_count += entry.live_count;
+			live_bytes += entry.live_bytes;
+			total_count += entry.total_count;
+			total_bytes += entry.total_bytes;
+		}
+
+	// The legacy heap_v2 format carries both the in use and the cumulative allocation samples,
+	// pprof scales them back up using the sampling interval
+	long long const interval = profiler ? profiler->sample_interval : 0;
+	out.print("heap profile: %6lld: %8lld [%6lld: %8lld] @ heap_v2/%lld\n", (long long)live_count, (long long)live_bytes, (long long)total_count, (long long)total_bytes, interval);
+
+	if (profiler)
+		for (Profiler::Stack const & entry : profiler->stacks)
+		{
+			if (entry.total_count == 0)
+				continue;
+			out.print("%6lld: %8lld [%6lld: %8lld] @", (long long)entry.live_count, (long long)entry.live_bytes, (long long)entry.total_count, (long long)entry.total_bytes);
+			for (int i = 0; i < entry.depth; ++i)
+				out.print(" %p", entry.frames[i]);
+			out.print("\n");
+		}
+
+	// pprof needs the mappings to symbolize the addresses
+	out.print("\nMAPPED_LIBRARIES:\n");
+	int const maps = open("/proc/self/maps", O_RDONLY);
+	if (maps >= 0)
+	{
+		char buffer[4096];
+		for (ssize_t bytes; (bytes = read(maps, buffer, sizeof(buffer))) > 0; )
+			out.append(buffer, bytes);
+		close(maps);
+	}
+}
+
+// ======================================================================
+
+ThreeHeap::OwnerStatistics & ThreeHeap::ownerStatistics(void const * const owner)
+{
+	OwnerTable & table = *owner_table;
+	if (!owner)
+		return table.unowned;
+
+	int const mask = OwnerTable::Capacity - 1;
+	for (int slot = static_cast<int>(HashPointer(owner)) & mask; ; slot = (slot + 1) & mask)
+	{
+		OwnerStatistics & entry = table.owners[slot];
+		if (entry.owner == owner)
+			return entry;
+
+		if (!entry.owner)
+		{
+			// Once the table is 3/4 full new owners get counted as unowned to keep the probes short
+			if (table.number_of_owners >= OwnerTable::Capacity / 4 * 3)
+				return table.unowned;
+			++table.number_of_owners;
+			entry.owner = owner;
+			return entry;
+		}
+	}
+}
+
+int ThreeHeap::getTopOwners(OwnerStatistics * const owners, int const count) const
+{
+	HEAP_LOCK();
+
+	if (!owner_table || count <= 0)
+		return 0;
+
+	// Insertion sort into the caller's array, which only ever holds the current top entries
+	int found = 0;
+	auto const consider = [&](OwnerStatistics const & entry)
+	{
+		if (entry.total_number_of_allocations == 0 && entry.current_number_of_allocations == 0)
+			return;
+		if (found == count && entry.current_number_of_bytes_allocated <= owners[found - 1].current_number_of_bytes_allocated)
+			return;
+
+		int i = (found < count) ? found++ : count - 1;
+		for (; i > 0 && owners[i - 1].current_number_of_bytes_allocated < entry.current_number_of_bytes_allocated; --i)
+			owners[i] = owners[i - 1];
+		owners[i] = entry;
+	};
+
+	consider(owner_table->unowned);
+	for (OwnerStatistics const & entry : owner_table->owners)
+		if (entry.owner)
+			consider(entry);
+
+	return found;
+}
+
+// ======================================================================
+
+uint64_t ThreeHeap::getTimestamp()
+{
+	return __rdtsc();
+}
+
+void ThreeHeap::recordLifetime(AllocatedBlock const * const block, OwnerStatistics const & owner)
+{
+	uint64_t const lifetime = getTimestamp() - block->timestamp;
+	int bucket = 63 - __builtin_clzll(lifetime | 1);
+	if (bucket >= LifetimeStatistics::NumberOfBuckets)
+		bucket = LifetimeStatistics::NumberOfBuckets - 1;
+
+	++owner_table->lifetime(owner).histogram[bucket];
+}
+
+int ThreeHeap::getOwnerLifetimes(LifetimeStatistics * const lifetimes, int const count, uint64_t const threshold) const
+{
+	HEAP_LOCK();
+
+	if (!owner_table || !owner_table->lifetimes || count <= 0)
+		return 0;
+
+	auto const frees = [](LifetimeStatistics const & statistics)
+	{
+		return statistics.short_lived + statistics.long_lived;
+	};
+
+	// Same insertion into the caller's array as getTopOwners, ordered by the number of frees
+	int found = 0;
+	auto const consider = [&](OwnerStatistics const & entry)
+	{
+		LifetimeStatistics statistics = owner_table->lifetime(entry);
+		statistics.owner = entry.owner;
+
+		// The histogram buckets are powers of two, so the split is rounded up to the next bucket boundary
+		for (int bucket = 0; bucket < LifetimeStatistics::NumberOfBuckets; ++bucket)
+		{
+			if ((uint64_t(1) << bucket) < threshold)
+				statistics.short_lived += statistics.histogram[bucket];
+			else
+				statistics.long_lived += statistics.histogram[bucket];
+		}
+
+		if (frees(statistics) == 0)
+			return;
+		if (found == count && frees(statistics) <= frees(lifetimes[found - 1]))
+			return;
+
+		int i = (found < count) ? found++ : count - 1;
+		for (; i > 0 && frees(lifetimes[i - 1]) < frees(statistics); --i)
+			lifetimes[i] = lifetimes[i - 1];
+		lifetimes[i] = statistics;
+	};
+
+	consider(owner_table->unowned);
+	for (OwnerStatistics const & entry : owner_table->owners)
+		if (entry.owner)
+			consider(entry);
+
+	return found;
+}
+
+// ======================================================================
+
+void ThreeHeap::recordTreeOperation(TreeStatistics::Operation & operation, int const nodes_visited)
+{
+	++operation.count;
+	operation.nodes_visited += nodes_visited;
+	if (nodes_visited > operation.maximum_nodes_visited)
+		operation.maximum_nodes_visited = nodes_visited;
+
+	int const bucket = nodes_visited ? 32 - __builtin_clz(nodes_visited) : 0;
+	++operation.histogram[(bucket < TreeStatistics::NumberOfBuckets) ? bucket : TreeStatistics::NumberOfBuckets - 1];
+}
+
+void ThreeHeap::getTreeShape(TreeShape & shape) const
+{
+	HEAP_LOCK();
+
+	shape = TreeShape();
+
+	auto const bucket = [](int const value)
+	{
+		int const length = value ? 32 - __builtin_clz(value) : 0;
+		return (length < TreeShape::NumberOfBuckets) ? length : TreeShape::NumberOfBuckets - 1;
+	};
+
+	// Walk the tree with the parent pointers rather than recursion, so a degenerate tree can't overflow the stack
+	FreeBlock const * previous = nullptr;
+	int depth = 1;
+	for (FreeBlock const * node = free_list; node; )
+	{
+		if (previous == node->parent)
+		{
+			// First visit to this distinct size, measure its equal chain
+			int chain = 1;
+			for (FreeBlock const * equal = node->equal; equal; equal = equal->equal)
+				++chain;
+
+			++shape.number_of_distinct_sizes;
+			shape.number_of_free_blocks += chain;
+			shape.total_depth += depth;
+			if (depth > shape.maximum_depth)
+				shape.maximum_depth = depth;
+			if (chain > shape.maximum_equal_chain)
+				shape.maximum_equal_chain = chain;
+			++shape.depth_histogram[bucket(depth)];
+			++shape.equal_chain_histogram[bucket(chain)];
+
+			if (node->less)
+			{
+				previous = node;
+				node = node->less;
+				++depth;
+				continue;
+			}
+		}
+
+		if (previous != node->greater && node->greater)
+		{
+			previous = node;
+			node = node->greater;
+			++depth;
+			continue;
+		}
+
+		// Both subtrees are done, head back up
+		previous = node;
+		node = node->parent;
+		--depth;
+	}
+}
+
+void ThreeHeap::getHugePageStatistics(HugePageStatistics & statistics) const
+{
+	HEAP_LOCK();
+
+	statistics = HugePageStatistics();
+	statistics.bytes_advised = huge_page_bytes_advised;
+	if (!huge_page_bytes_advised)
+		return;
+
+	int const fd = open("/proc/self/smaps", O_RDONLY);
+	if (fd < 0)
+		return;
+
+	// Sum AnonHugePages over the mappings advised for huge pages that overlap the heap's system allocations,
+	// reading line by line through a stack buffer so the heap is never called
+	char buffer[16 * 1024];
+	int used = 0;
+	intptr_t mapping_start = 0;
+	intptr_t mapping_end = 0;
+	int64_t mapping_huge_bytes = 0;
+	for (;;)
+	{
+		ssize_t const bytes = read(fd, buffer + used, sizeof(buffer) - 1 - used);
+		if (bytes <= 0)
+			break;
+		used += static_cast<int>(bytes);
+		buffer[used] = '\0';
+
+		char * line = buffer;
+		for (char * newline; (newline = strchr(line, '\n')) != nullptr; line = newline + 1)
+		{
+			*newline = '\0';
+			unsigned long start, end;
+			long kilobytes;
+			if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+			{
+				mapping_start = static_cast<intptr_t>(start);
+				mapping_end = static_cast<intptr_t>(end);
+				mapping_huge_bytes = 0;
+			}
+			else if (sscanf(line, "AnonHugePages: %ld kB", &kilobytes) == 1)
+				mapping_huge_bytes = kilobytes * 1024;
+			else if (strncmp(line, "VmFlags:", 8) == 0 && strstr(line, " hg") && mapping_huge_bytes)
+			{
+				for (SystemAllocation const * allocation = first_system_allocation; allocation; allocation = allocation->next)
+					if (mapping_start < reinterpret_cast<intptr_t>(allocation->end) && reinterpret_cast<intptr_t>(allocation) < mapping_end)
+					{
+						statistics.bytes_in_huge_pages += mapping_huge_bytes;
+						break;
+					}
+			}
+		}
+
+		// Keep the partial line for the next read
+		used -= static_cast<int>(line - buffer);
+		memmove(buffer, line, used);
+	}
+	close(fd);
+}
+
+// ======================================================================
+
+ThreeHeap::SystemAllocation * ThreeHeap::findSystemAllocation(void const * const memory) const
+{
+	// Every page of a system allocation maps back to it
+	uintptr_t const page = PageMap::get(memory);
+	assert(PageMap::tier(page) == PageTier::Blocks);
+	return static_cast<SystemAllocation *>(PageMap::owner(page));
+}
+
+void ThreeHeap::markUnfilled(SystemAllocation * const allocation, intptr_t const address, int64_t const size)
+{
+	SetBits(allocation->unfilled, allocation->granule(address), size / Alignment);
+}
+
+void ThreeHeap::clearUnfilled(SystemAllocation * const allocation, intptr_t const address, int64_t const size)
+{
+	ClearBits(allocation->unfilled, allocation->granule(address), size / Alignment);
+}
+
+int64_t ThreeHeap::purge(int64_t const minimum_size)
+{
+	HEAP_LOCK();
+
+	if (!external.system_memory_zeroed())
+		return 0;
+
+#if USE_FAST_BINS
+	consolidateFastBins();
+#endif
+
+	int64_t purged = 0;
+	for (SystemAllocation * allocation = first_system_allocation; allocation; allocation = allocation->next)
+		purged += purgeSystemAllocation(allocation, minimum_size);
+	return purged;
+}
+
+int64_t ThreeHeap::purgeSystemAllocation(SystemAllocation * const allocation, int64_t const minimum_size, bool const idle_only)
+{
+	// Purging part of a huge page would break it back up into small pages
+	intptr_t const page_size = heap_flags.useHugePages() ? HugePageSize : SystemPageSize;
+
+	int64_t purged = 0;
+	for (Block * block = allocation->start->next; block != allocation->end; block = block->next)
+	{
+		if (block->status != BlockStatus::Free || block->fixed || block->contents == BlockContents::Zero || block->size < minimum_size)
+			continue;
+
+		// Blocks seen free for the first time are only marked, they go back to the system if they are still free next time
+		if (idle_only && !block->idle)
+		{
+			block->idle = 1;
+			continue;
+		}
+
+		// Only whole pages go back to the system, the partial pages at either end are cleared by hand
+		intptr_t const start = reinterpret_cast<intptr_t>(block) + HeaderSize;
+		intptr_t const end = reinterpret_cast<intptr_t>(block) + block->size;
+		intptr_t const page_start = (start + page_size - 1) & ~(page_size - 1);
+		intptr_t const page_end = end & ~(page_size - 1);
+		if (page_end <= page_start)
+			continue;
+
+		memset(reinterpret_cast<void *>(start), 0, page_start - start);
+		memset(reinterpret_cast<void *>(page_end), 0, end - page_end);
+		if (madvise(reinterpret_cast<void *>(page_start), page_end - page_start, MADV_DONTNEED) != 0)
+			memset(reinterpret_cast<void *>(page_start), 0, page_end - page_start);
+		else
+			purged += page_end - page_start;
+
+#if USE_FILL_FREES
+		// The memory stays zero rather than getting its deferred free fill
+		if (allocation->unfilled)
+			clearUnfilled(allocation, start, end - start);
+#endif
+		block->contents = BlockContents::Zero;
+	}
+
+	return purged;
+}
+
+int64_t ThreeHeap::flushFreeFills(int64_t const max_bytes)
+{
+	HEAP_LOCK();
+
+	if (!heap_flags.lazyFillFrees() || !first_system_allocation)
+		return 0;
+
+	// Resume where the last flush stopped, and go around the system allocations at most once
+	if (!flush_allocation)
+	{
+		flush_allocation = first_system_allocation;
+		flush_granule = 0;
+	}
+
+	int64_t filled = 0;
+	SystemAllocation * const first = flush_allocation;
+	for (bool wrapped = false; ; )
+	{
+		SystemAllocation * const allocation = flush_allocation;
+		int64_t const end = allocation->granule(reinterpret_cast<intptr_t>(allocation->end));
+		while (flush_granule < end && filled < max_bytes)
+		{
+			int64_t const first_unfilled = FindBit(allocation->unfilled, flush_granule, end, true);
+			int64_t last_unfilled = FindBit(allocation->unfilled, first_unfilled, end, false);
+			if (last_unfilled - first_unfilled > (max_bytes - filled) / Alignment)
+				last_unfilled = first_unfilled + (max_bytes - filled + Alignment - 1) / Alignment;
+
+			int64_t const size = (last_unfilled - first_unfilled) * Alignment;
+			Fill(reinterpret_cast<void *>(allocation->address(first_unfilled)), FreeFillChar, size);
+			ClearBits(allocation->unfilled, first_unfilled, last_unfilled - first_unfilled);
+			filled += size;
+			flush_granule = last_unfilled;
+		}
+
+		if (filled >= max_bytes || wrapped)
+			break;
+
+		flush_allocation = allocation->next ? allocation->next : first_system_allocation;
+		flush_granule = 0;
+		wrapped = (flush_allocation == first);
+	}
+
+	return filled;
+}
+
+// ======================================================================
+
+void ThreeHeap::setQuarantineSize(int64_t const bytes)
+{
+	HEAP_LOCK();
+
+	if (!quarantine)
+	{
+		if (bytes <= 0)
+			return;
+		quarantine = new(allocateMetadata(sizeof(Quarantine))) Quarantine();
+	}
+
+	quarantine->budget = (bytes > 0) ? bytes : 0;
+	trimQuarantine();
+}
+
+int64_t ThreeHeap::getCurrentNumberOfBytesQuarantined() const
+{
+	return quarantine ? quarantine->bytes : 0;
+}
+
+void ThreeHeap::flushQuarantine()
+{
+	HEAP_LOCK();
+
+	if (!quarantine)
+		return;
+
+	int64_t const budget = quarantine->budget;
+	quarantine->budget = 0;
+	trimQuarantine();
+	quarantine->budget = budget;
+}
+
+void ThreeHeap::quarantineBlock(AllocatedBlock * const block)
+{
+	// Fill the whole block, guard bands included, so any write while it sits here shows up when it leaves
+	Fill(reinterpret_cast<void *>(reinterpret_cast<intptr_t>(block) + HeaderSize), FreeFillChar, block->size - HeaderSize);
+	block->status = BlockStatus::Quarantined;
+
+	Quarantine & q = *quarantine;
+	if (q.count == Quarantine::Capacity)
+		releaseQuarantined();
+	q.blocks[(q.first + q.count) % Quarantine::Capacity] = block;
+	++q.count;
+	q.bytes += block->size;
+
+	trimQuarantine();
+}
+
+void ThreeHeap::trimQuarantine()
+{
+	while (quarantine->count && quarantine->bytes > quarantine->budget)
+		releaseQuarantined();
+}
+
+void ThreeHeap::releaseQuarantined()
+{
+	Quarantine & q = *quarantine;
+	AllocatedBlock * const block = q.blocks[q.first];
+	q.first = (q.first + 1) % Quarantine::Capacity;
+	--q.count;
+	q.bytes -= block->size;
+
+	assert(block->marker == Block::Marker);
+	assert(block->status == BlockStatus::Quarantined);
+
+#if USE_VERIFY_FREES
+	void const * const memory = reinterpret_cast<void const *>(reinterpret_cast<intptr_t>(block) + HeaderSize);
+	int64_t const size = block->size - HeaderSize;
+	int64_t const index = FindMismatch(memory, size, FreeFillChar);
+	if (index != size)
+	{
+		ErrorInfo info;
+		info.type = ErrorInfo::Type::FreeCorruption;
+		info.memory = memory;
+		info.size = size;
+		info.free_corrupt_index = static_cast<int>(index);
+		info.owner = block->owner;
+		info.allocation_flags = block->flags;
+		external.error(info);
+	}
+#endif
+
+	block->status = BlockStatus::Allocated;
+	releaseBlock(block, block->flags, true);
+}
+
+// ======================================================================
+
+ThreeHeap::Handle ThreeHeap::allocateHandle(int64_t const size, Flags const flags, void * const owner)
+{
+	HEAP_LOCK();
+
+	if (!handle_table)
+		handle_table = new(allocateMetadata(sizeof(HandleTable))) HandleTable();
+
+	// Reuse freed entries before taking new ones
+	HandleTable & table = *handle_table;
+	int index = table.first_free;
+	if (index >= 0)
+		table.first_free = table.entries[index].next_free;
+	else if (table.number_used < HandleTable::Capacity)
+		index = table.number_used++;
+	else
+		return nullptr;
+
+	HandleTable::Entry & entry = table.entries[index];
+	entry.memory = allocate(size, 0, flags, owner);
+	entry.lock_count = 0;
+	entry.next_free = -1;
+	entry.flags = flags;
+
+	// Guarded allocations have no block to move, so they simply stay where they are
+	if (PageMap::tier(PageMap::get(entry.memory)) == PageTier::Blocks)
+		getAllocatedBlock(entry.memory)->handle = index + 1;
+	return reinterpret_cast<Handle>(&entry.memory);
+}
+
+void ThreeHeap::freeHandle(Handle const handle)
+{
+	HEAP_LOCK();
+
+	if (!handle)
+		return;
+
+	HandleTable::Entry & entry = HandleTable::entry(handle);
+	assert(entry.lock_count == 0);
+	free(entry.memory, entry.flags);
+
+	entry.memory = nullptr;
+	entry.next_free = handle_table->first_free;
+	handle_table->first_free = static_cast<int>(&entry - handle_table->entries);
+}
+
+void * ThreeHeap::lockHandle(Handle const handle)
+{
+	HEAP_LOCK();
+
+	HandleTable::Entry & entry = HandleTable::entry(handle);
+	++entry.lock_count;
+	return entry.memory;
+}
+
+void ThreeHeap::unlockHandle(Handle const handle)
+{
+	HEAP_LOCK();
+
+	HandleTable::Entry & entry = HandleTable::entry(handle);
+	assert(entry.lock_count > 0);
+	--entry.lock_count;
+}
+
+int64_t ThreeHeap::compact()
+{
+	HEAP_LOCK();
+
+	if (!handle_table)
+		return 0;
+
+#if USE_FAST_BINS
+	consolidateFastBins();
+#endif
+	next_fit = nullptr;
+	verify_block = nullptr;
+
+	int64_t moved = 0;
+	for (SystemAllocation * allocation = first_system_allocation; allocation; allocation = allocation->next)
+	{
+		// Free blocks are gathered into a hole that unlocked handle blocks slide down into, anything else that
+		// can't move closes the hole off as a single free block in front of it
+		Block * last = allocation->start;
+		intptr_t hole = 0;
+		for (Block * block = allocation->start->next; ; )
+		{
+			Block * const next = (block == allocation->end) ? nullptr : block->next;
+
+			if (block->status == BlockStatus::Free && !block->fixed)
+			{
+				FreeBlock * const free_block = static_cast<FreeBlock *>(block);
+				if (free_block == victim)
+					victim = nullptr;
+				else
+					removeFromFreeList(free_block);
+				if (!hole)
+					hole = reinterpret_cast<intptr_t>(block);
+				block = next;
+				continue;
+			}
+
+			// Sampled blocks are tracked by address in the heap profile, so they stay put too
+			AllocatedBlock * const allocated = static_cast<AllocatedBlock *>(block);
+			bool const movable = block->status == BlockStatus::Allocated && allocated->handle && !allocated->flags.isSampled() &&
+				handle_table->entries[allocated->handle - 1].lock_count == 0;
+			if (hole && movable)
+			{
+				int64_t const size = block->size;
+				memmove(reinterpret_cast<void *>(hole), block, size);
+				AllocatedBlock * const moved_block = reinterpret_cast<AllocatedBlock *>(hole);
+				moved_block->previous = last;
+				last->next = moved_block;
+				handle_table->entries[moved_block->handle - 1].memory = moved_block->memory();
+
+#if USE_FILL_FREES
+				// The header may have landed on what was a free block's data, so the whole block comes out of the deferred fills
+				if (allocation->unfilled)
+					clearUnfilled(allocation, hole, size);
+#endif
+
+				moved += size;
+				hole += size;
+				last = moved_block;
+				block = next;
+				continue;
+			}
+
+			if (hole)
+			{
+				// The hole becomes one free block between the last settled block and this one
+				FreeBlock * const free_block = new(reinterpret_cast<void *>(hole)) FreeBlock();
+				free_block->status = BlockStatus::Free;
+				free_block->size = reinterpret_cast<intptr_t>(block) - hole;
+				free_block->previous = last;
+				free_block->next = block;
+				last->next = free_block;
+				block->previous = free_block;
+
+#if USE_FILL_FREES
+				if (heap_flags.fillFrees())
+				{
+					if (allocation->unfilled)
+						markUnfilled(allocation, hole + HeaderSize, free_block->size - HeaderSize);
+					else
+						Fill(reinterpret_cast<void *>(hole + HeaderSize), FreeFillChar, free_block->size - HeaderSize);
+					free_block->contents = BlockContents::FreeFilled;
+				}
+#endif
+				addToFreeList(free_block);
+				hole = 0;
+			}
+
+			if (block == allocation->end)
+				break;
+			last = block;
+			block = next;
+		}
+	}
+
+	return moved;
+}
+
+// ======================================================================
+
+void ThreeHeap::setFastBinLimit(int64_t const bytes)
+{
+	HEAP_LOCK();
+
+	fast_bin_limit = (bytes > 0) ? bytes : 0;
+	if (fast_bin_bytes > fast_bin_limit)
+		consolidateFastBins();
+}
+
+int64_t ThreeHeap::getCurrentNumberOfBytesBinned() const
+{
+	return fast_bin_bytes;
+}
+
+void ThreeHeap::binBlock(AllocatedBlock * const block)
+{
+	// Binned memory counts as free even though it isn't in the tree
+	int64_t const size = block->size;
+	current_bytes_used -= size;
+	current_bytes_free += size;
+
+	FreeBlock * const binned = static_cast<FreeBlock *>(static_cast<Block *>(block));
+	int const bin = static_cast<int>(size / Alignment) - 1;
+	binned->status = BlockStatus::Binned;
+	binned->less = fast_bins[bin];
+	fast_bins[bin] = binned;
+	fast_bin_bytes += size;
+
+	if (fast_bin_bytes > fast_bin_limit)
+		consolidateFastBins();
+}
+
+void ThreeHeap::consolidateFastBins()
+{
+	HEAP_LOCK();
+
+	for (FreeBlock * & bin : fast_bins)
+		while (bin)
+		{
+			AllocatedBlock * const block = static_cast<AllocatedBlock *>(static_cast<Block *>(bin));
+			bin = bin->less;
+			assert(block->status == BlockStatus::Binned);
+
+			// releaseBlock moves the block from used to free itself
+			current_bytes_used += block->size;
+			current_bytes_free -= block->size;
+			block->status = BlockStatus::Allocated;
+			releaseBlock(block, zero, false);
+		}
+
+	fast_bin_bytes = 0;
+}
+
+// ======================================================================
+
+void ThreeHeap::setGuardedSampleRate(int const one_in)
+{
+	HEAP_LOCK();
+
+	if (one_in <= 0)
+	{
+		// Outstanding guarded allocations stay where they are until they are freed
+		if (guarded_pool)
+			guarded_pool->sample_rate = 0;
+		guarded_countdown = INT64_MAX;
+		return;
+	}
+
+	if (!guarded_pool)
+	{
+		// The pool needs page granular protection, so it is mapped directly rather than through the system allocator
+		int64_t const size = (2 * GuardedPool::NumberOfSlots + 1) * GuardedPool::PageSize;
+		void * const memory = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return;
+
+		guarded_pool = new(allocateMetadata(sizeof(GuardedPool))) GuardedPool();
+		guarded_pool->heap = this;
+		guarded_pool->start = reinterpret_cast<intptr_t>(memory);
+		guarded_pool->end = guarded_pool->start + size;
+
+		if (!GuardedPool::pools)
+		{
+			struct sigaction action = {};
+			action.sa_sigaction = GuardedPool::faultHandler;
+			action.sa_flags = SA_SIGINFO;
+			sigemptyset(&action.sa_mask);
+			sigaction(SIGSEGV, &action, &GuardedPool::previous_action);
+		}
+		guarded_pool->next = GuardedPool::pools;
+		GuardedPool::pools = guarded_pool;
+		PageMap::set(guarded_pool->start, guarded_pool->end, guarded_pool, PageTier::Guarded);
+	}
+
+	guarded_pool->sample_rate = one_in;
+	guarded_countdown = one_in;
+}
+
+void * ThreeHeap::allocateGuarded(int64_t const size, Flags const flags, void * const owner)
+{
+	GuardedPool & pool = *guarded_pool;
+
+	// Spread the samples out uniformly with an average of one every sample_rate allocations
+	guarded_countdown = NextUniformInterval(pool.random, pool.sample_rate);
+
+	if (size > GuardedPool::PageSize)
+		return nullptr;
+
+	// Hand out the slots round robin, so a freed slot stays inaccessible for as long as possible
+	int index = -1;
+	for (int i = 0; i < GuardedPool::NumberOfSlots; ++i)
+	{
+		int const candidate = (pool.next_slot + i) % GuardedPool::NumberOfSlots;
+		if (!pool.slots[candidate].allocated)
+		{
+			index = candidate;
+			break;
+		}
+	}
+	if (index < 0)
+		return nullptr;
+	pool.next_slot = (index + 1) % GuardedPool::NumberOfSlots;
+
+	intptr_t const page = pool.page(index);
+	if (mprotect(reinterpret_cast<void *>(page), GuardedPool::PageSize, PROT_READ | PROT_WRITE) != 0)
+		return nullptr;
+
+	// Right align the allocation against the following guard page
+	int64_t const rounded = (size ? size : 1) + Padding(static_cast<int>(size ? size : 1), GuardedPool::SlotAlignment);
+	void * const result = reinterpret_cast<void *>(page + GuardedPool::PageSize - rounded);
+
+	GuardedPool::Slot & slot = pool.slots[index];
+	slot.memory = result;
+	slot.size = size;
+	slot.owner = owner;
+	slot.flags = flags;
+	slot.allocated = true;
+
+	// Update metrics
+	++total_number_of_allocations;
+	++current_number_of_allocations;
+	if (current_number_of_allocations > maximum_number_of_allocations)
+		maximum_number_of_allocations = current_number_of_allocations;
+
+	total_bytes_allocated += size;
+	current_bytes_allocated += size;
+	if (current_bytes_allocated > maximum_bytes_allocated)
+		maximum_bytes_allocated = current_bytes_allocated;
+
+#if USE_OWNER_STATISTICS
+	if (owner_table)
+	{
+		OwnerStatistics & statistics = ownerStatistics(owner);
+		++statistics.current_number_of_allocations;
+		statistics.current_number_of_bytes_allocated += size;
+		++statistics.total_number_of_allocations;
+	}
+#endif
+
+	// The slot's page still holds whatever its previous allocation left there
+	if (flags.IsMallocCalloc())
+		memset(result, 0, size);
+#if USE_FILL_ALLOCATIONS
+	else if (flags.fillAllocations())
+		Fill(result, AllocationFillChar, size);
+#endif
+
+	REPORT_OPERATION(result, size, 0, owner, flags | report_allocation);
+	return result;
+}
+
+void ThreeHeap::freeGuarded(void * const memory, Flags const flags)
+{
+	GuardedPool::Slot & slot = guarded_pool->slot(memory);
+	if (!slot.allocated || slot.memory != memory)
+	{
+		ErrorInfo info;
+		info.type = ErrorInfo::Type::DoubleFree;
+		info.memory = memory;
+		info.size = slot.size;
+		info.owner = slot.owner;
+		info.allocation_flags = slot.flags;
+		info.free_flags = flags;
+		external.error(info);
+		return;
+	}
+
+	// Make sure the allocation flags match the delete flags
+	if ((slot.flags & free_check) != (flags & free_check))
+	{
+		ErrorInfo info;
+		info.type = ErrorInfo::Type::MismatchedFree;
+		info.memory = memory;
+		info.size = slot.size;
+		info.allocation_flags = slot.flags;
+		info.free_flags = flags;
+		external.error(info);
+		return;
+	}
+
+	// Update metrics
+	++total_number_of_frees;
+	--current_number_of_allocations;
+	current_bytes_allocated -= slot.size;
+
+#if USE_OWNER_STATISTICS
+	if (owner_table)
+	{
+		OwnerStatistics & statistics = ownerStatistics(slot.owner);
+		--statistics.current_number_of_allocations;
+		statistics.current_number_of_bytes_allocated -= slot.size;
+	}
+#endif
+
+	REPORT_OPERATION(memory, slot.size, 0, slot.owner, slot.flags | report_free);
+
+	// Keep the slot's details around to report a later use after free
+	slot.allocated = false;
+	intptr_t const page = reinterpret_cast<intptr_t>(memory) & ~(GuardedPool::PageSize - 1);
+	mprotect(reinterpret_cast<void *>(page), GuardedPool::PageSize, PROT_NONE);
+}
+
+// ======================================================================
+
+void ThreeHeap::setDebugSampleRate(int const one_in, Flags const debug_flags)
+{
+	HEAP_LOCK();
+
+	debug_sample_rate = one_in > 0 ? one_in : 0;
+	debug_sample_flags = debug_flags;
+	debug_countdown = debug_sample_rate ? NextUniformInterval(debug_random, debug_sample_rate) : INT64_MAX;
+}
+
+// ======================================================================
+
+void ThreeHeap::setMaintenanceInterval(int const milliseconds, Flags const verify_flags)
+{
+#if USE_MAINTENANCE
+	if (!maintenance)
+	{
+		if (milliseconds <= 0)
+			return;
+		maintenance = new(allocateMetadata(sizeof(Maintenance))) Maintenance();
+	}
+
+	// The thread is stopped without holding the heap lock, since it needs the lock to finish its tick
+	if (maintenance->thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> const lock(maintenance->wake_mutex);
+			maintenance->stop = true;
+		}
+		maintenance->wake.notify_one();
+		maintenance->thread.join();
+	}
+
+	HEAP_LOCK();
+
+	maintenance->stop = false;
+	maintenance->milliseconds = milliseconds > 0 ? milliseconds : 0;
+	maintenance->verify_flags = verify_flags;
+	if (maintenance->milliseconds)
+		maintenance->thread = std::thread(&ThreeHeap::maintain, this);
+#else
+	(void)milliseconds;
+	(void)verify_flags;
+#endif
+}
+
+void ThreeHeap::maintain()
+{
+#if USE_MAINTENANCE
+	std::unique_lock<std::mutex> wake_lock(maintenance->wake_mutex);
+	while (!maintenance->wake.wait_for(wake_lock, std::chrono::milliseconds(maintenance->milliseconds), [this] { return maintenance->stop; }))
+	{
+		HEAP_LOCK();
+
+#if USE_FILL_FREES
+		flushFreeFills(Maintenance::FillBudget);
+#endif
+
+		// One system allocation per tick, so each tick holds the lock for a bounded time however large the heap grows
+		SystemAllocation * const allocation = maintenance->cursor ? maintenance->cursor : first_system_allocation;
+		if (!allocation)
+			continue;
+		maintenance->cursor = allocation->next;
+
+		// Purge laps are spaced out in time rather than ticks, so freed memory isn't handed back and faulted in again
+		// while it is still being reused, and the fast bins get to do their job in between
+		if (allocation == first_system_allocation)
+		{
+			auto const now = std::chrono::steady_clock::now();
+			maintenance->purge_lap = now - maintenance->purge_lap_start >= Maintenance::PurgeInterval;
+			if (maintenance->purge_lap)
+			{
+				maintenance->purge_lap_start = now;
+#if USE_FAST_BINS
+				consolidateFastBins();
+#endif
+			}
+		}
+
+		if (maintenance->purge_lap && external.system_memory_zeroed())
+			purgeSystemAllocation(allocation, Maintenance::PurgeMinimumSize, true);
+
+		verifySystemAllocation(allocation, maintenance->verify_flags);
+	}
+#endif
 }
@@ -0,0 +1,157 @@
+#include <ThreeHeap.h>
+
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Compare two snapshots from ThreeHeap::writeSnapshot() and report which owners (or sampled call stacks) grew
+
+namespace
+{
+	struct Totals
+	{
+		int64_t count = 0;
+		int64_t bytes = 0;
+	};
+
+	struct Growth
+	{
+		uint64_t key = 0;
+		Totals before;
+		Totals after;
+	};
+
+	bool readSnapshot(char const * const file_name, std::vector<ThreeHeap::SnapshotRecord> & records)
+	{
+		int const fd = open(file_name, O_RDONLY);
+		if (fd < 0)
+		{
+			fprintf(stderr, "threeheap-diff: can't open %s\n", file_name);
+			return false;
+		}
+
+		// Read in large chunks, the records are fixed size and the header says how big
+		std::vector<char> data;
+		char buffer[1024 * 1024];
+		for (ssize_t bytes; (bytes = read(fd, buffer, sizeof(buffer))) > 0; )
+			data.insert(data.end(), buffer, buffer + bytes);
+		close(fd);
+
+		ThreeHeap::SnapshotHeader header;
+		if (data.size() < sizeof(header))
+		{
+			fprintf(stderr, "threeheap-diff: %s is too short to be a snapshot\n", file_name);
+			return false;
+		}
+		memcpy(&header, data.data(), sizeof(header));
+		if (header.magic != ThreeHeap::SnapshotHeader::Magic || header.version != ThreeHeap::SnapshotHeader::Version || header.record_size != sizeof(ThreeHeap::SnapshotRecord))
+		{
+			fprintf(stderr, "threeheap-diff: %s is not a version %u snapshot\n", file_name, ThreeHeap::SnapshotHeader::Version);
+			return false;
+		}
+
+		if ((data.size() - sizeof(header)) % sizeof(ThreeHeap::SnapshotRecord))
+		{
+			fprintf(stderr, "threeheap-diff: %s is corrupt, it ends part way through a record\n", file_name);
+			return false;
+		}
+
+		size_t const number_of_records = (data.size() - sizeof(header)) / sizeof(ThreeHeap::SnapshotRecord);
+		records.resize(number_of_records);
+		memcpy(records.data(), data.data() + sizeof(header), number_of_records * sizeof(ThreeHeap::SnapshotRecord));
+		return true;
+	}
+
+	void accumulate(std::vector<ThreeHeap::SnapshotRecord> const & records, bool const by_stack, std::unordered_map<uint64_t, Growth> & growth, Totals Growth::* const side)
+	{
+		for (ThreeHeap::SnapshotRecord const & record : records)
+		{
+			uint64_t const key = by_stack ? record.stack : record.owner;
+			Growth & entry = growth[key];
+			entry.key = key;
+			++(entry.*side).count;
+			(entry.*side).bytes += record.size;
+		}
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	bool by_stack = false;
+	int limit = 50;
+	char const * files[2] = {};
+	int number_of_files = 0;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string_view const argument(argv[i]);
+		if (argument == "--stacks")
+			by_stack = true;
+		else if (argument == "--limit" && i + 1 < argc)
+			limit = atoi(argv[++i]);
+		else if (number_of_files < 2)
+			files[number_of_files++] = argv[i];
+		else
+			number_of_files = 3;
+	}
+	if (number_of_files != 2)
+	{
+		fprintf(stderr, "usage: threeheap-diff [--stacks] [--limit count] before.snapshot after.snapshot\n");
+		return 2;
+	}
+
+	std::vector<ThreeHeap::SnapshotRecord> before;
+	std::vector<ThreeHeap::SnapshotRecord> after;
+	if (!readSnapshot(files[0], before) || !readSnapshot(files[1], after))
+		return 1;
+
+	std::unordered_map<uint64_t, Growth> growth;
+	accumulate(before, by_stack, growth, &Growth::before);
+	accumulate(after, by_stack, growth, &Growth::after);
+
+	Totals total_before;
+	Totals total_after;
+	std::vector<Growth> changed;
+	for (auto const & [key, entry] : growth)
+	{
+		total_before.count += entry.before.count;
+		total_before.bytes += entry.before.bytes;
+		total_after.count += entry.after.count;
+		total_after.bytes += entry.after.bytes;
+		if (entry.before.count != entry.after.count || entry.before.bytes != entry.after.bytes)
+			changed.push_back(entry);
+	}
+
+	// Largest growth first, ties broken by the allocation count growth
+	std::sort(changed.begin(), changed.end(), [](Growth const & lhs, Growth const & rhs)
+	{
+		int64_t const lhs_bytes = lhs.after.bytes - lhs.before.bytes;
+		int64_t const rhs_bytes = rhs.after.bytes - rhs.before.bytes;
+		if (lhs_bytes != rhs_bytes)
+			return lhs_bytes > rhs_bytes;
+		return (lhs.after.count - lhs.before.count) > (rhs.after.count - rhs.before.count);
+	});
+
+	printf("total: %lld allocations %lld bytes -> %lld allocations %lld bytes (%+lld allocations %+lld bytes)\n",
+		(long long)total_before.count, (long long)total_before.bytes, (long long)total_after.count, (long long)total_after.bytes,
+		(long long)(total_after.count - total_before.count), (long long)(total_after.bytes - total_before.bytes));
+	printf("%16s %12s %14s %12s %14s  %s\n", "bytes growth", "count growth", "bytes", "count", "bytes before", by_stack ? "stack" : "owner");
+
+	int printed = 0;
+	for (Growth const & entry : changed)
+	{
+		if (printed++ == limit)
+			break;
+		printf("%+16lld %+12lld %14lld %12lld %14lld  0x%llx\n",
+			(long long)(entry.after.bytes - entry.before.bytes), (long long)(entry.after.count - entry.before.count),
+			(long long)entry.after.bytes, (long long)entry.after.count, (long long)entry.before.bytes, (unsigned long long)entry.key);
+	}
+
+	return 0;
+}
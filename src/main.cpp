@@ -1,5 +1,9 @@
 #include <GlobalHeap.h>
+#include <ThreeArena.h>
+#include <ThreeHeapResource.h>
+#include <ThreePool.h>
 
+#include <memory_resource>
 #include <string_view>
 #include <vector>
 
@@ -7,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define USE_THREEHEAP 1
@@ -16,8 +21,524 @@ void * pointer[number_of_allocations];
 std::vector<int> full;
 std::vector<int> empty;
 
-int main()
+// The heaps the tests make for themselves don't print every operation
+struct QuietInterface : public ThreeHeap::DefaultInterface
 {
+	void report_operation(const void *, int64_t, int, const void *, ThreeHeap::Flags) override {}
+};
+
+// Replay the same random trace under every placement policy and compare the peak memory used to the peak live bytes,
+// the overhead is how much more system memory than the peak live bytes the heap needed
+int placementBenchmark()
+{
+	struct Policy
+	{
+		ThreeHeap::PlacementPolicy policy;
+		char const * name;
+	};
+	Policy const policies[] =
+	{
+		{ ThreeHeap::PlacementPolicy::BestFit, "best fit" },
+		{ ThreeHeap::PlacementPolicy::AddressOrderedBestFit, "address ordered best fit" },
+		{ ThreeHeap::PlacementPolicy::FirstFit, "first fit" },
+		{ ThreeHeap::PlacementPolicy::NextFit, "next fit" },
+		{ ThreeHeap::PlacementPolicy::SizeClassBestFit, "size class best fit" },
+	};
+
+	// Only the statistics are wanted, not every operation, and the system memory grows in small steps so the
+	// footprint shows the fragmentation rather than the 16mb granularity
+	struct BenchmarkInterface : public ThreeHeap::DefaultInterface
+	{
+		void report_operation(const void *, int64_t, int, const void *, ThreeHeap::Flags) override {}
+
+		void * system_allocator(int64_t & size) override
+		{
+			int64_t const granularity = 256 * 1024;
+			size = (size + granularity - 1) / granularity * granularity;
+			return sbrk(size);
+		}
+	};
+
+	printf("%-26s %12s %12s %12s %8s %8s\n", "policy", "peak live", "peak used", "system", "overhead", "seconds");
+	for (Policy const & policy : policies)
+	{
+		BenchmarkInterface heap_interface;
+		ThreeHeap heap(heap_interface, ThreeHeap::heap_fast);
+		heap.setPlacementPolicy(policy.policy);
+
+		// Mostly small blocks with some medium and a few large ones, shifting the mix every phase so old holes go stale
+		srand(1);
+		clock_t const start = clock();
+		for (int loops = 0; loops < 1'000'000; ++loops)
+		{
+			int const slot = rand() % number_of_allocations;
+			if (pointer[slot])
+			{
+				heap.free(pointer[slot], ThreeHeap::malloc);
+				pointer[slot] = nullptr;
+				continue;
+			}
+
+			int const phase = loops / 125'000;
+			int const kind = rand() % 100;
+			int size;
+			if (kind < 70)
+				size = 16 + rand() % (128 << (phase % 3));
+			else if (kind < 95)
+				size = 1024 + rand() % (8 * 1024);
+			else
+				size = 16 * 1024 + rand() % (48 * 1024);
+			pointer[slot] = heap.allocate(size, 0, ThreeHeap::malloc);
+		}
+		double const seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+
+		int64_t const peak_live = heap.getMaximumNumberOfBytesAllocated();
+		int64_t const peak_used = heap.getMaximumNumberOfBytesUsed();
+		int64_t const system = heap.getCurrentNumberOfBytesUsed() + heap.getCurrentNumberOfBytesFree();
+		printf("%-26s %12lld %12lld %12lld %7.1f%% %8.2f\n", policy.name, (long long)peak_live, (long long)peak_used, (long long)system,
+			100.0 * (system - peak_live) / peak_live, seconds);
+
+		for (void * & memory : pointer)
+		{
+			heap.free(memory, ThreeHeap::malloc);
+			memory = nullptr;
+		}
+	}
+
+	return 0;
+}
+
+// Sample every few kb of a run of allocations, free some of them, and write out the heap profile
+void profileTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug);
+	heap.setProfileSampleInterval(4 * 1024);
+
+	int constexpr number_of_allocations = 1000;
+	void * allocations[number_of_allocations];
+	for (int i = 0; i < number_of_allocations; ++i)
+		allocations[i] = heap.allocate(64 + (i % 32) * 32, 0, ThreeHeap::malloc);
+	for (int i = 0; i < number_of_allocations; i += 2)
+		heap.free(allocations[i], ThreeHeap::malloc);
+
+	FILE * const profile = tmpfile();
+	heap.writeHeapProfile(fileno(profile));
+	fseek(profile, 0, SEEK_SET);
+	char line[256] = {};
+	fgets(line, sizeof(line), profile);
+	fclose(profile);
+	printf("%s", line);
+
+	for (int i = 1; i < number_of_allocations; i += 2)
+		heap.free(allocations[i], ThreeHeap::malloc);
+	heap.setProfileSampleInterval(0);
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+}
+
+// Spread allocations over a few owners, freeing some straight away and the rest later, and print what each owner holds
+// and how long its allocations lived
+void ownerTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug | ThreeHeap::track_lifetimes);
+
+	int constexpr number_of_owners = 4;
+	int owners[number_of_owners];
+	int constexpr number_of_allocations = 400;
+	void * allocations[number_of_allocations];
+	for (int i = 0; i < number_of_allocations; ++i)
+	{
+		allocations[i] = heap.allocate(32 * (i % number_of_owners + 1), 0, ThreeHeap::malloc, &owners[i % number_of_owners]);
+		if (i % 3 == 0)
+		{
+			heap.free(allocations[i], ThreeHeap::malloc);
+			allocations[i] = nullptr;
+		}
+	}
+
+	ThreeHeap::OwnerStatistics top[number_of_owners];
+	int const number_of_top = heap.getTopOwners(top, number_of_owners);
+	for (int i = 0; i < number_of_top; ++i)
+		printf("owner %d allocations %d bytes %lld\n", static_cast<int>(static_cast<int const *>(top[i].owner) - owners),
+			top[i].current_number_of_allocations, (long long)top[i].current_number_of_bytes_allocated);
+
+	for (void * memory : allocations)
+		heap.free(memory, ThreeHeap::malloc);
+
+	ThreeHeap::LifetimeStatistics lifetimes[number_of_owners];
+	uint64_t const threshold = 1024;
+	int const number_of_lifetimes = heap.getOwnerLifetimes(lifetimes, number_of_owners, threshold);
+	for (int i = 0; i < number_of_lifetimes; ++i)
+		printf("owner %d frees %lld\n", static_cast<int>(static_cast<int const *>(lifetimes[i].owner) - owners),
+			(long long)(lifetimes[i].short_lived + lifetimes[i].long_lived));
+
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+}
+
+// Churn a mix of sizes through the free tree and print how deep its operations went and its shape at the end
+void treeStatisticsTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug | ThreeHeap::tree_statistics);
+
+	int constexpr number_of_allocations = 2000;
+	void * allocations[number_of_allocations] = {};
+	for (int i = 0; i < 20 * number_of_allocations; ++i)
+	{
+		int const slot = (i * 7919) % number_of_allocations;
+		heap.free(allocations[slot], ThreeHeap::malloc);
+		allocations[slot] = heap.allocate(16 + (i % 100) * 40, 0, ThreeHeap::malloc);
+	}
+	for (int i = 0; i < number_of_allocations; i += 2)
+	{
+		heap.free(allocations[i], ThreeHeap::malloc);
+		allocations[i] = nullptr;
+	}
+
+	ThreeHeap::TreeStatistics const & statistics = heap.getTreeStatistics();
+	ThreeHeap::TreeShape shape;
+	heap.getTreeShape(shape);
+	printf("tree search %lld insert %lld remove %lld, deepest insert %d, %d free blocks %d sizes depth %d\n",
+		(long long)statistics.search.count, (long long)statistics.insert.count, (long long)statistics.remove.count,
+		statistics.insert.maximum_nodes_visited, shape.number_of_free_blocks, shape.number_of_distinct_sizes, shape.maximum_depth);
+
+	for (void * memory : allocations)
+		heap.free(memory, ThreeHeap::malloc);
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+}
+
+// Freed blocks wait in the quarantine until it goes over its size, and are checked as they come out of it
+void quarantineTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug);
+	heap.setQuarantineSize(64 * 1024);
+
+	for (int i = 0; i < 1000; ++i)
+		heap.free(heap.allocate(64 + i % 512, 0, ThreeHeap::malloc), ThreeHeap::malloc);
+	printf("quarantined %lld bytes\n", (long long)heap.getCurrentNumberOfBytesQuarantined());
+
+	heap.flushQuarantine();
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+}
+
+// Every allocation goes on its own page right up against a guard page, the pool goes away with the heap
+void guardedTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug);
+	heap.setGuardedSampleRate(1);
+
+	int constexpr number_of_allocations = 100;
+	void * allocations[number_of_allocations];
+	int guarded = 0;
+	for (int i = 0; i < number_of_allocations; ++i)
+	{
+		int const size = 16 + i * 16;
+		allocations[i] = heap.allocate(size, 0, ThreeHeap::malloc);
+		memset(allocations[i], i, size);
+		guarded += ((reinterpret_cast<intptr_t>(allocations[i]) + size) & 4095) == 0;
+	}
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+
+	for (void * memory : allocations)
+		heap.free(memory, ThreeHeap::malloc);
+	heap.setGuardedSampleRate(0);
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("guarded allocations %d of %d\n", guarded, number_of_allocations);
+}
+
+// A fast heap that adds the debug checks to some of its allocations, only those come back filled
+void debugSampleTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_fast);
+	heap.setDebugSampleRate(4);
+
+	int constexpr number_of_allocations = 1000;
+	void * allocations[number_of_allocations];
+	int sampled = 0;
+	for (int i = 0; i < number_of_allocations; ++i)
+	{
+		allocations[i] = heap.allocate(33, 0, ThreeHeap::malloc);
+		sampled += *static_cast<unsigned char *>(allocations[i]) == 0xcd;
+		memset(allocations[i], 1, 33);
+	}
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+
+	for (void * memory : allocations)
+		heap.free(memory, ThreeHeap::malloc);
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("debug sampled allocations %d of %d\n", sampled, number_of_allocations);
+}
+
+// Objects from a pool directly and through a per thread cache, and an arena rewound to a marker, all on the global heap
+void poolTest()
+{
+	struct Object
+	{
+		Object(int object_value) : value(object_value) {}
+		int value;
+		char payload[44];
+	};
+
+	int constexpr number_of_objects = 1000;
+	Object * objects[number_of_objects];
+	int bad = 0;
+	{
+		ThreePool<Object> pool(g_heap, nullptr, 64);
+		for (int i = 0; i < number_of_objects; ++i)
+			objects[i] = pool.create(i);
+		for (int i = 0; i < number_of_objects; i += 2)
+			pool.destroy(objects[i]);
+
+		// The cache hands back what it holds in batches, and everything on flush
+		{
+			ThreePool<Object>::Cache cache(pool);
+			for (int i = 0; i < number_of_objects; i += 2)
+				objects[i] = cache.create(-i);
+			for (int i = 0; i < number_of_objects; ++i)
+				bad += objects[i]->value != ((i & 1) ? i : -i);
+			for (int i = 0; i < number_of_objects; i += 2)
+				cache.destroy(objects[i]);
+		}
+		for (int i = 1; i < number_of_objects; i += 2)
+			pool.destroy(objects[i]);
+		printf("pool allocations %d current %d slabs bytes %lld\n", pool.getTotalNumberOfAllocations(), pool.getCurrentNumberOfAllocations(), (long long)pool.getCurrentNumberOfBytesUsed());
+	}
+
+	{
+		ThreeArena arena(g_heap, 4 * 1024);
+		memset(arena.allocate(100), 1, 100);
+		ThreeArena::Marker const marker = arena.getMarker();
+		int const blocks = arena.getNumberOfBlocks();
+		for (int i = 0; i < 200; ++i)
+			memset(arena.allocate(64 + i), 2, 64 + i);
+		memset(arena.allocate(64 * 1024), 3, 64 * 1024);
+		arena.rewind(marker);
+		bad += arena.getNumberOfBlocks() != blocks || arena.getCurrentNumberOfBytesAllocated() != 100;
+		printf("arena blocks %d bytes %lld after rewind\n", arena.getNumberOfBlocks(), (long long)arena.getCurrentNumberOfBytesAllocated());
+	}
+
+	g_heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("pool and arena %d bad\n", bad);
+}
+
+// Standard containers over the global heap through the allocator and the memory resources
+void allocatorTest()
+{
+	int bad = 0;
+	int owner = 0;
+	{
+		std::vector<int, ThreeHeapAllocator<int>> numbers{ThreeHeapAllocator<int>(g_heap, &owner)};
+		for (int i = 0; i < 10000; ++i)
+			numbers.push_back(i);
+		for (int i = 0; i < 10000; ++i)
+			bad += numbers[i] != i;
+
+		// Rebound copies of the allocator compare equal, and allocate_at_least reports at least what was asked for
+		ThreeHeapAllocator<double> doubles(numbers.get_allocator());
+		bad += !(doubles == numbers.get_allocator());
+		ThreeHeapAllocationResult<double> const result = doubles.allocate_at_least(100);
+		bad += result.count < 100;
+		doubles.deallocate(result.ptr, result.count);
+	}
+
+	{
+		ThreeHeapResource resource(g_heap);
+		std::pmr::vector<std::pmr::vector<int>> nested(&resource);
+		for (int i = 0; i < 100; ++i)
+			nested.emplace_back(i, i);
+		for (int i = 0; i < 100; ++i)
+			bad += static_cast<int>(nested[i].size()) != i;
+
+		// Over aligned memory keeps the heap's pointer in front of it
+		void * const aligned = resource.allocate(100, 256);
+		bad += (reinterpret_cast<intptr_t>(aligned) & 255) != 0;
+		resource.deallocate(aligned, 100, 256);
+	}
+
+	{
+		ThreeArena arena(g_heap);
+		ThreeArenaResource resource(arena);
+		std::pmr::vector<int> numbers(&resource);
+		for (int i = 0; i < 10000; ++i)
+			numbers.push_back(i);
+		bad += numbers.back() != 9999;
+	}
+
+	g_heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("allocators %d bad\n", bad);
+}
+
+// Hand the pages of a large free block back to the system, a calloc from them can skip clearing
+void purgeTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug);
+
+	int64_t constexpr size = 4 * 1024 * 1024;
+	char * memory = static_cast<char *>(heap.allocate(size, 0, ThreeHeap::malloc));
+	memset(memory, 1, size);
+	heap.free(memory, ThreeHeap::malloc);
+	int64_t const purged = heap.purge();
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+
+	memory = static_cast<char *>(heap.allocate(size, 0, ThreeHeap::malloc_calloc));
+	int nonzero = 0;
+	for (int64_t i = 0; i < size; ++i)
+		nonzero += memory[i] != 0;
+	heap.free(memory, ThreeHeap::malloc);
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("purged %lld bytes, calloc from them has %d nonzero bytes\n", (long long)purged, nonzero);
+}
+
+// Back a heap with transparent huge pages and measure how much of it the kernel actually gave huge pages
+void hugePageTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug | ThreeHeap::huge_pages);
+
+	int64_t constexpr size = 8 * 1024 * 1024;
+	void * const memory = heap.allocate(size, 0, ThreeHeap::malloc);
+	memset(memory, 1, size);
+
+	ThreeHeap::HugePageStatistics statistics;
+	heap.getHugePageStatistics(statistics);
+	heap.free(memory, ThreeHeap::malloc);
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("huge pages advised %lld bytes, %lld bytes backed\n", (long long)statistics.bytes_advised, (long long)statistics.bytes_in_huge_pages);
+}
+
+// Small free blocks go in the size index instead of the tree, under both the default and address ordered placement
+void sizeIndexTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug | ThreeHeap::size_index);
+
+	int constexpr number_of_allocations = 2000;
+	void * allocations[number_of_allocations] = {};
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		heap.setPlacementPolicy(pass ? ThreeHeap::PlacementPolicy::AddressOrderedBestFit : ThreeHeap::PlacementPolicy::BestFit);
+		for (int i = 0; i < 10 * number_of_allocations; ++i)
+		{
+			int const slot = (i * 7919) % number_of_allocations;
+			heap.free(allocations[slot], ThreeHeap::malloc);
+			allocations[slot] = heap.allocate(16 + (i % 64) * 24, 0, ThreeHeap::malloc);
+		}
+		heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	}
+
+	for (void * memory : allocations)
+		heap.free(memory, ThreeHeap::malloc);
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("size index %lld bytes free\n", (long long)heap.getCurrentNumberOfBytesFree());
+}
+
+// Free every other handle allocation, then compact the survivors down over the lazily filled holes and do the deferred
+// fills, the moved blocks must come through with their contents and headers intact
+void handleTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::fill_frees | ThreeHeap::lazy_fill_frees);
+
+	int constexpr number_of_handles = 256;
+	ThreeHeap::Handle handles[number_of_handles];
+	for (int i = 0; i < number_of_handles; ++i)
+	{
+		int const size = 64 + (i % 16) * 48;
+		handles[i] = heap.allocateHandle(size);
+		memset(*handles[i], i, size);
+	}
+	for (int i = 0; i < number_of_handles; i += 2)
+		heap.freeHandle(handles[i]);
+
+	// A locked handle stays where it is
+	void * const locked = heap.lockHandle(handles[number_of_handles / 2 + 1]);
+	int64_t const moved = heap.compact();
+	heap.flushFreeFills();
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	assert(*handles[number_of_handles / 2 + 1] == locked);
+	heap.unlockHandle(handles[number_of_handles / 2 + 1]);
+
+	int corrupt = 0;
+	for (int i = 1; i < number_of_handles; i += 2)
+	{
+		unsigned char const * const memory = static_cast<unsigned char const *>(*handles[i]);
+		for (int j = 0; j < 64 + (i % 16) * 48; ++j)
+			corrupt += memory[j] != i;
+		heap.freeHandle(handles[i]);
+	}
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("handles compacted %lld bytes, %d corrupt bytes\n", (long long)moved, corrupt);
+}
+
+// Let the maintenance thread do the deferred free fills and verify the heap in the background while it is being used
+void maintenanceTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug | ThreeHeap::lazy_fill_frees);
+	heap.setMaintenanceInterval(1, ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+
+	int constexpr number_of_allocations = 1000;
+	void * allocations[number_of_allocations] = {};
+	for (int i = 0; i < 10 * number_of_allocations; ++i)
+	{
+		int const slot = (i * 7919) % number_of_allocations;
+		heap.free(allocations[slot], ThreeHeap::malloc);
+		allocations[slot] = heap.allocate(16 + (i % 100) * 40, 0, ThreeHeap::malloc);
+	}
+	for (void * memory : allocations)
+		heap.free(memory, ThreeHeap::malloc);
+
+	usleep(100 * 1000);
+	heap.setMaintenanceInterval(0);
+	int64_t const unfilled = heap.flushFreeFills();
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("maintenance left %lld bytes unfilled\n", (long long)unfilled);
+}
+
+// Verify the global heap a few hundred blocks at a time until a lap is done, then across several threads
+void verifyTest()
+{
+	int steps = 1;
+	while (!g_heap.verifyStep(256, ThreeHeap::validate_free | ThreeHeap::validate_guard_bands))
+		++steps;
+	g_heap.verifyParallel(4, ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	g_heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("verified in %d steps\n", steps);
+}
+
+// Snapshot the live allocations of a heap and count the records that were written
+void snapshotTest()
+{
+	QuietInterface heap_interface;
+	ThreeHeap heap(heap_interface, ThreeHeap::heap_debug | ThreeHeap::track_owners);
+
+	int constexpr number_of_allocations = 100;
+	void * allocations[number_of_allocations];
+	for (int i = 0; i < number_of_allocations; ++i)
+		allocations[i] = heap.allocate(64 + i, 0, ThreeHeap::malloc, allocations);
+
+	FILE * const snapshot = tmpfile();
+	heap.writeSnapshot(fileno(snapshot));
+	fseek(snapshot, 0, SEEK_END);
+	long const records = (ftell(snapshot) - static_cast<long>(sizeof(ThreeHeap::SnapshotHeader))) / static_cast<long>(sizeof(ThreeHeap::SnapshotRecord));
+	fclose(snapshot);
+
+	for (void * memory : allocations)
+		heap.free(memory, ThreeHeap::malloc);
+	heap.verify(ThreeHeap::validate_free | ThreeHeap::validate_guard_bands);
+	printf("snapshot of %ld allocations\n", records);
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc > 1 && std::string_view(argv[1]) == "placement")
+		return placementBenchmark();
+
 	srand(0);
 
 #if USE_THREEHEAP
@@ -124,6 +645,22 @@ int main()
 	delete [] r;
 #endif
 
+	profileTest();
+	ownerTest();
+	treeStatisticsTest();
+	quarantineTest();
+	guardedTest();
+	debugSampleTest();
+	poolTest();
+	allocatorTest();
+	purgeTest();
+	hugePageTest();
+	sizeIndexTest();
+	handleTest();
+	maintenanceTest();
+	verifyTest();
+	snapshotTest();
+
 	// Print memory leaks
 	printf("memory leaks:\n");
 	g_heap.report_allocations();